@@ -6,98 +6,667 @@
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 #include <linux/uaccess.h>
-
-/* device memory buffer size */
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/uio.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/moduleparam.h>
+#include <linux/rwsem.h>
+#include <linux/io_uring/cmd.h>
+
+#include "pcd_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "pcd_trace.h"
+
+/* default device memory size */
 #define DEV_MEM_SIZE   512U
 
-/* kernel buffer of the pcd driver*/
-char pcd_buffer[DEV_MEM_SIZE] = {0};
+/* device memory size, accepts K/M/G suffixes e.g. insmod pcd.ko mem_size=256M */
+char *mem_size;
+module_param(mem_size, charp, S_IRUSR);
+MODULE_PARM_DESC(mem_size, "size of the device memory (default 512 bytes)");
+
+/* streaming mode: the device acts as a pipe between a producer and a consumer */
+bool stream_mode;
+module_param(stream_mode, bool, S_IRUSR);
+MODULE_PARM_DESC(stream_mode, "use the device as a FIFO of mem_size bytes (rounded up to a power of two)");
+
+/* size of the device memory in bytes and in pages */
+loff_t pcd_mem_size;
+unsigned long pcd_nr_pages;
+
+/*
+ * kernel buffer of the pcd driver: one slot per page of device memory.
+ * Pages are allocated zeroed on first write or first mmap fault, so a
+ * large device only costs memory for the parts that are actually used.
+ */
+struct page **pcd_pages;
+
+/*
+ * Readers copy out of the device memory concurrently under the read side of
+ * pcd_mem_lock, a writer holds the write side so no reader ever sees a half
+ * written request. Page lookup itself is lock-free (see pcd_get_page()).
+ * User space mappings bypass this lock, mmap users have to agree on their
+ * own protocol.
+ */
+DECLARE_RWSEM(pcd_mem_lock);
+
+/* return the page backing page index, allocating it on first touch if alloc is set */
+static struct page *pcd_get_page(pgoff_t index, bool alloc)
+{
+	struct page *page = READ_ONCE(pcd_pages[index]);
+
+	if(page || !alloc)
+		return page;
+
+	page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+	if(!page)
+		return NULL;
+
+	/* another writer may have populated the slot in the meantime */
+	if(cmpxchg(&pcd_pages[index], NULL, page))
+	{
+		__free_page(page);
+		page = READ_ONCE(pcd_pages[index]);
+	}
+	return page;
+}
+
+/*
+ * I/O statistics.
+ *
+ * Every CPU counts into its own copy of struct pcd_stats, so the read/write
+ * paths never share a cache line; the copies are only summed when somebody
+ * reads the sysfs attributes. Latency is kept as a log2 histogram: bucket n
+ * counts calls that took [2^(n-1), 2^n) ns.
+ */
+#define PCD_HIST_BUCKETS   32
+
+enum pcd_stat_op
+{
+	PCD_STAT_READ,
+	PCD_STAT_WRITE,
+	PCD_STAT_NR_OPS
+};
+
+struct pcd_stats
+{
+	u64 ops[PCD_STAT_NR_OPS];
+	u64 bytes[PCD_STAT_NR_OPS];
+	u64 short_xfers;
+	u64 efaults;
+	u64 latency_hist[PCD_STAT_NR_OPS][PCD_HIST_BUCKETS];
+};
+
+DEFINE_PER_CPU(struct pcd_stats, pcd_stats);
 
-/* file operations from the file_operations struct of fs.h */
-ssize_t pcd_read (struct file * flip, char __user * buff, size_t count, loff_t * f_pos)
+/* account one read or write that started at start_ns and returned ret */
+static void pcd_stats_account(enum pcd_stat_op op, size_t count, ssize_t ret, u64 start_ns)
 {
-	pr_info("requested to read bytes: %zu \r\n", count);
-	pr_info("previous file position : %lld\r\n", *f_pos);
+	u64 delta = ktime_get_ns() - start_ns;
+	unsigned int bucket = min_t(unsigned int, fls64(delta), PCD_HIST_BUCKETS - 1);
+
+	this_cpu_inc(pcd_stats.ops[op]);
+	if(ret > 0)
+	{
+		this_cpu_add(pcd_stats.bytes[op], ret);
+		if((size_t)ret < count)
+			this_cpu_inc(pcd_stats.short_xfers);
+	}
+	else if(ret == -EFAULT)
+	{
+		this_cpu_inc(pcd_stats.efaults);
+	}
+	this_cpu_inc(pcd_stats.latency_hist[op][bucket]);
+}
+
+/* sum one u64 counter, given by its offset in struct pcd_stats, over all CPUs */
+static u64 pcd_stats_sum(size_t field)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *)((char *)per_cpu_ptr(&pcd_stats, cpu) + field);
+	return sum;
+}
+
+/*
+ * copy device memory at *ppos into the iterator, one page at a time.
+ * The request is bounds checked once, whatever segments the iterator holds.
+ * With nowait set the call fails with -EAGAIN instead of waiting for a writer.
+ */
+static ssize_t pcd_mem_read (struct iov_iter * to, loff_t * ppos, bool nowait)
+{
+	loff_t pos = *ppos;
+	size_t count = iov_iter_count(to);
+	size_t done = 0;
+
 	/* 1. adjust the  count */
-	if((*f_pos + count) > DEV_MEM_SIZE)
-		count = DEV_MEM_SIZE - *f_pos;
+	if(pos >= pcd_mem_size || !count)
+		return 0;
+	count = min_t(loff_t, count, pcd_mem_size - pos);
+
+	if(nowait)
+	{
+		if(!down_read_trylock(&pcd_mem_lock))
+			return -EAGAIN;
+	}
+	else if(down_read_killable(&pcd_mem_lock))
+	{
+		return -EINTR;
+	}
+
+	/* 2. copy to the user segments, one page at a time */
+	while(done < count)
+	{
+		size_t offset = offset_in_page(pos);
+		size_t chunk = min_t(size_t, PAGE_SIZE - offset, count - done);
+		struct page *page = pcd_get_page(pos >> PAGE_SHIFT, false);
+		size_t copied;
+
+		/* never written page reads back as zeroes */
+		if(page)
+			copied = copy_page_to_iter(page, offset, chunk, to);
+		else
+			copied = iov_iter_zero(chunk, to);
+
+		done += copied;
+		pos += copied;
+		if(copied < chunk)
+			break;
+	}
 
-	/* 2. copy_to_user */
-	if(!copy_to_user(&buff[0], &pcd_buffer[*f_pos], count))
+	up_read(&pcd_mem_lock);
+
+	if(!done)
 		return -EFAULT;
-	/* 3. update the f_pos w.r.t count */
-	*f_pos += count;
 
-	pr_info("No of bytes read from pcd_read: %zu\r\n", count);
-	pr_info("Update file position: %lld\r\n", *f_pos);
-	return count;
+	/* 3. update the file position w.r.t count */
+	*ppos = pos;
+	return done;
 }
 
-/* write operations from user space to kernel space */
-ssize_t pcd_write (struct file * filp, const char __user * buff, size_t count, loff_t * f_pos)
+/* copy the iterator into device memory at *ppos, populating pages as needed */
+static ssize_t pcd_mem_write (struct iov_iter * from, loff_t * ppos, bool nowait)
 {
-    pr_info("Requested bytes to write: %zu\n", count);
-    pr_info("Previous file position: %lld\n", *f_pos);
+	loff_t pos = *ppos;
+	size_t count = iov_iter_count(from);
+	size_t done = 0;
+	ssize_t retval = -EFAULT;
 
-    /* 1. validate the count */
-    if ((*f_pos + count) > DEV_MEM_SIZE)
-        count = DEV_MEM_SIZE - *f_pos;
+	/* 1. validate the count */
+	if(pos >= pcd_mem_size)
+		return -ENOMEM;
+	count = min_t(loff_t, count, pcd_mem_size - pos);
 
-    if (!count)
-        return -ENOMEM;
+	if(!count)
+		return 0;
 
-    /* 2. copy_from_user */
-    if (copy_from_user(&pcd_buffer[*f_pos], buff, count))
-        return -EFAULT;
+	if(nowait)
+	{
+		if(!down_write_trylock(&pcd_mem_lock))
+			return -EAGAIN;
+	}
+	else if(down_write_killable(&pcd_mem_lock))
+	{
+		return -EINTR;
+	}
 
-    /* 3. update f_pos */
-    *f_pos += count;
+	/* 2. copy from the user segments, one page at a time */
+	while(done < count)
+	{
+		size_t offset = offset_in_page(pos);
+		size_t chunk = min_t(size_t, PAGE_SIZE - offset, count - done);
+		struct page *page = pcd_get_page(pos >> PAGE_SHIFT, true);
+		size_t copied;
+
+		if(!page)
+		{
+			retval = -ENOMEM;
+			break;
+		}
+
+		copied = copy_page_from_iter(page, offset, chunk, from);
+
+		done += copied;
+		pos += copied;
+		if(copied < chunk)
+			break;
+	}
+
+	up_write(&pcd_mem_lock);
 
-    /* Add a terminating null so printk shows it as a string */
-    if (*f_pos < DEV_MEM_SIZE)
-        pcd_buffer[*f_pos] = '\0';
+	if(!done)
+		return retval;
 
-    pr_info("User wrote: %s\n", pcd_buffer);
-    pr_info("Current file position: %lld\n", *f_pos);
+	/* 3. update the file position */
+	*ppos = pos;
+	return done;
+}
 
-    return count;
+/*
+ * file operations from the file_operations struct of fs.h
+ *
+ * read_iter/write_iter take an iov_iter, so one call serves read(), readv(),
+ * preadv2() and aio alike. The hot paths report through the pcd tracepoints
+ * instead of printk, e.g.
+ *   echo 1 > /sys/kernel/tracing/events/pcd/enable
+ */
+ssize_t pcd_read_iter (struct kiocb * iocb, struct iov_iter * to)
+{
+	size_t count = iov_iter_count(to);
+	loff_t pos = iocb->ki_pos;
+	u64 start = ktime_get_ns();
+	ssize_t retval;
+
+	retval = pcd_mem_read(to, &iocb->ki_pos, iocb->ki_flags & IOCB_NOWAIT);
+	pcd_stats_account(PCD_STAT_READ, count, retval, start);
+	trace_pcd_read(count, pos, retval);
+	return retval;
+}
+
+/* write operations from user space to kernel space */
+ssize_t pcd_write_iter (struct kiocb * iocb, struct iov_iter * from)
+{
+	size_t count = iov_iter_count(from);
+	loff_t pos = iocb->ki_pos;
+	u64 start = ktime_get_ns();
+	ssize_t retval;
+
+	retval = pcd_mem_write(from, &iocb->ki_pos, iocb->ki_flags & IOCB_NOWAIT);
+	pcd_stats_account(PCD_STAT_WRITE, count, retval, start);
+	trace_pcd_write(count, pos, retval);
+	return retval;
 }
 
 
 /* open the device driver file */
 int pcd_open (struct inode * inode, struct file * flip)
 {
-	pr_info("open file operation called\r\n");
+	trace_pcd_open(inode, flip, 0);
 	return 0;
 } 
 
 /* close the device file  */
 int pcd_release (struct inode * inode, struct file * flip)
 {
-	pr_info("release operation called\r\n");
+	trace_pcd_release(inode, flip, 0);
 	return 0;
 }
 
+/* run one PCD_IOC_BATCH entry or uring command, returns bytes moved or -errno */
+static ssize_t pcd_batch_one (const struct pcd_batch_op * op, bool nowait)
+{
+	struct iov_iter iter;
+	loff_t pos = op->offset;
+	u64 start = ktime_get_ns();
+	ssize_t retval;
+
+	if(op->flags || op->offset > pcd_mem_size)
+		return -EINVAL;
+
+	switch(op->op)
+	{
+		case PCD_OP_READ:
+			retval = import_ubuf(ITER_DEST, u64_to_user_ptr(op->addr), op->len, &iter);
+			if(retval)
+				return retval;
+			retval = pcd_mem_read(&iter, &pos, nowait);
+			pcd_stats_account(PCD_STAT_READ, op->len, retval, start);
+			trace_pcd_read(op->len, op->offset, retval);
+			break;
+		case PCD_OP_WRITE:
+			retval = import_ubuf(ITER_SOURCE, u64_to_user_ptr(op->addr), op->len, &iter);
+			if(retval)
+				return retval;
+			retval = pcd_mem_write(&iter, &pos, nowait);
+			pcd_stats_account(PCD_STAT_WRITE, op->len, retval, start);
+			trace_pcd_write(op->len, op->offset, retval);
+			break;
+		default:
+			retval = -EINVAL;
+	}
+	return retval;
+}
+
+/*
+ * PCD_IOC_BATCH: run up to PCD_BATCH_MAX positional reads/writes in one
+ * system call. Entries run in order and a failing entry does not stop the
+ * batch, its result field carries the error instead.
+ */
+long pcd_ioctl (struct file * filp, unsigned int cmd, unsigned long arg)
+{
+	struct pcd_batch_op __user *uops;
+	struct pcd_batch_op op;
+	struct pcd_batch batch;
+	u32 i;
+
+	if(cmd != PCD_IOC_BATCH)
+		return -ENOTTY;
+
+	if(copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+		return -EFAULT;
+
+	if(batch.flags || batch.nr_ops > PCD_BATCH_MAX)
+		return -EINVAL;
+
+	uops = u64_to_user_ptr(batch.ops);
+	for(i = 0; i < batch.nr_ops; i++)
+	{
+		if(copy_from_user(&op, &uops[i], sizeof(op)))
+			return -EFAULT;
+
+		if(put_user((s64)pcd_batch_one(&op, false), &uops[i].result))
+			return -EFAULT;
+
+		if(fatal_signal_pending(current))
+			return -EINTR;
+	}
+	return 0;
+}
+
+/*
+ * io_uring passthrough (IORING_OP_URING_CMD). The copy itself is synchronous,
+ * so the result goes straight back as the completion. When io_uring issues the
+ * command inline from io_uring_enter() it should not block: if a writer holds
+ * pcd_mem_lock the command returns -EAGAIN and io_uring re-issues it from an
+ * io-wq worker, where it may block without stalling the submitter.
+ */
+int pcd_uring_cmd (struct io_uring_cmd * ioucmd, unsigned int issue_flags)
+{
+	struct pcd_batch_op op;
+
+	if(ioucmd->cmd_op != PCD_URING_CMD_RW)
+		return -ENOTTY;
+
+	/* struct pcd_batch_op does not fit in the 16 byte command area of a normal sqe */
+	if(!(issue_flags & IO_URING_F_SQE128))
+		return -EINVAL;
+
+	/* the sqe lives in memory shared with user space, work on a private copy */
+	memcpy(&op, io_uring_sqe_cmd(ioucmd->sqe), sizeof(op));
+
+	return pcd_batch_one(&op, issue_flags & IO_URING_F_NONBLOCK);
+}
+
 /* lseek the current file position pointer */
 loff_t pcd_llseek (struct file * filp, loff_t offset, int whence)
 {
-	pr_info("lseek operation called\r\n");
+	loff_t new_pos;
 
 	switch (whence)
 	{
 		case SEEK_SET:
-			filp->f_pos = offset;
+			new_pos = offset;
 			break;
 		case SEEK_CUR:
-			filp->f_pos += offset;
+			new_pos = filp->f_pos + offset;
 			break;
 		case SEEK_END:
-			filp->f_pos = DEV_MEM_SIZE + offset;
+			new_pos = pcd_mem_size + offset;
 			break;
 		default:
-			return -EINVAL;
+			new_pos = -EINVAL;
+			goto out;
+	}
+
+	/* the position must stay inside the device memory */
+	if(new_pos < 0 || new_pos > pcd_mem_size)
+	{
+		new_pos = -EINVAL;
+		goto out;
+	}
+
+	filp->f_pos = new_pos;
+out:
+	trace_pcd_llseek(offset, whence, new_pos);
+	return new_pos;
+}
+
+/* page fault on a user mapping of the device memory */
+static vm_fault_t pcd_vm_fault(struct vm_fault *vmf)
+{
+	struct page *page;
+
+	if(vmf->pgoff >= pcd_nr_pages)
+		return VM_FAULT_SIGBUS;
+
+	page = pcd_get_page(vmf->pgoff, true);
+	if(!page)
+		return VM_FAULT_OOM;
+
+	get_page(page);
+	vmf->page = page;
+	return 0;
+}
+
+static const struct vm_operations_struct pcd_vm_ops =
+{
+	.fault = pcd_vm_fault,
+};
+
+/* map the device memory into the user address space, pages are faulted in on first access */
+int pcd_mmap (struct file * filp, struct vm_area_struct * vma)
+{
+	if(vma->vm_pgoff + vma_pages(vma) > pcd_nr_pages)
+	{
+		trace_pcd_mmap(vma->vm_pgoff, vma_pages(vma), -EINVAL);
+		return -EINVAL;
 	}
-	return filp->f_pos;
+
+	vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+	vma->vm_ops = &pcd_vm_ops;
+	trace_pcd_mmap(vma->vm_pgoff, vma_pages(vma), 0);
+	return 0;
+}
+
+/*
+ * Streaming (FIFO) mode.
+ *
+ * kfifo needs no locking with exactly one reader and one writer, so each side
+ * only takes its own mutex to serialize concurrent readers or concurrent
+ * writers; a reader never waits for a writer's lock or the other way around.
+ * Readers sleep on pcd_fifo_readq until data arrives, writers sleep on
+ * pcd_fifo_writeq until there is room.
+ */
+struct kfifo pcd_fifo;
+DEFINE_MUTEX(pcd_fifo_read_lock);
+DEFINE_MUTEX(pcd_fifo_write_lock);
+DECLARE_WAIT_QUEUE_HEAD(pcd_fifo_readq);
+DECLARE_WAIT_QUEUE_HEAD(pcd_fifo_writeq);
+
+/* the fifo has no file position, so open it as a stream */
+int pcd_fifo_open (struct inode * inode, struct file * filp)
+{
+	int retval = stream_open(inode, filp);
+
+	trace_pcd_open(inode, filp, retval);
+	return retval;
+}
+
+/* consume data from the fifo, sleeping while it is empty unless O_NONBLOCK */
+static ssize_t pcd_fifo_consume (struct file * filp, char __user * buff, size_t count)
+{
+	unsigned int copied;
+	int retval;
+
+	if(!count)
+		return 0;
+
+	if(mutex_lock_interruptible(&pcd_fifo_read_lock))
+		return -ERESTARTSYS;
+
+	while(kfifo_is_empty(&pcd_fifo))
+	{
+		mutex_unlock(&pcd_fifo_read_lock);
+
+		if(filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		if(wait_event_interruptible(pcd_fifo_readq, !kfifo_is_empty(&pcd_fifo)))
+			return -ERESTARTSYS;
+
+		if(mutex_lock_interruptible(&pcd_fifo_read_lock))
+			return -ERESTARTSYS;
+	}
+
+	retval = kfifo_to_user(&pcd_fifo, buff, count, &copied);
+	mutex_unlock(&pcd_fifo_read_lock);
+
+	/* room was made, let a blocked writer in */
+	if(copied)
+		wake_up_interruptible_poll(&pcd_fifo_writeq, EPOLLOUT | EPOLLWRNORM);
+
+	return copied ? copied : retval;
+}
+
+/* produce data into the fifo, sleeping while it is full unless O_NONBLOCK */
+static ssize_t pcd_fifo_produce (struct file * filp, const char __user * buff, size_t count)
+{
+	unsigned int copied;
+	int retval;
+
+	if(!count)
+		return 0;
+
+	if(mutex_lock_interruptible(&pcd_fifo_write_lock))
+		return -ERESTARTSYS;
+
+	while(kfifo_is_full(&pcd_fifo))
+	{
+		mutex_unlock(&pcd_fifo_write_lock);
+
+		if(filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		if(wait_event_interruptible(pcd_fifo_writeq, !kfifo_is_full(&pcd_fifo)))
+			return -ERESTARTSYS;
+
+		if(mutex_lock_interruptible(&pcd_fifo_write_lock))
+			return -ERESTARTSYS;
+	}
+
+	retval = kfifo_from_user(&pcd_fifo, buff, count, &copied);
+	mutex_unlock(&pcd_fifo_write_lock);
+
+	/* data arrived, wake up a sleeping reader */
+	if(copied)
+		wake_up_interruptible_poll(&pcd_fifo_readq, EPOLLIN | EPOLLRDNORM);
+
+	return copied ? copied : retval;
+}
+
+ssize_t pcd_fifo_read (struct file * filp, char __user * buff, size_t count, loff_t * f_pos)
+{
+	u64 start = ktime_get_ns();
+	ssize_t retval = pcd_fifo_consume(filp, buff, count);
+
+	pcd_stats_account(PCD_STAT_READ, count, retval, start);
+	trace_pcd_read(count, 0, retval);
+	return retval;
+}
+
+ssize_t pcd_fifo_write (struct file * filp, const char __user * buff, size_t count, loff_t * f_pos)
+{
+	u64 start = ktime_get_ns();
+	ssize_t retval = pcd_fifo_produce(filp, buff, count);
+
+	pcd_stats_account(PCD_STAT_WRITE, count, retval, start);
+	trace_pcd_write(count, 0, retval);
+	return retval;
+}
+
+/* poll/select/epoll support: readable while data is queued, writable while there is room */
+__poll_t pcd_fifo_poll (struct file * filp, poll_table * wait)
+{
+	__poll_t mask = 0;
+
+	poll_wait(filp, &pcd_fifo_readq, wait);
+	poll_wait(filp, &pcd_fifo_writeq, wait);
+
+	if(!kfifo_is_empty(&pcd_fifo))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if(!kfifo_is_full(&pcd_fifo))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+
+	return mask;
+}
+
+/* drop the reference of a page splice_to_pipe() could not place in the pipe */
+static void pcd_spd_release(struct splice_pipe_desc * spd, unsigned int i)
+{
+	put_page(spd->pages[i]);
+}
+
+/*
+ * splice()/sendfile()/tee() source: instead of copying, hand the device pages
+ * themselves to the pipe, up to PIPE_DEF_BUFFERS pages per call. The pipe sees
+ * the live page, just like a page cache splice, so a later write to the device
+ * is visible to data still sitting in the pipe. Holes are not populated: like
+ * read(), they are spliced as the shared zero page, which a later write does
+ * not change.
+ */
+ssize_t pcd_splice_read (struct file * in, loff_t * ppos, struct pipe_inode_info * pipe, size_t len, unsigned int flags)
+{
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd =
+	{
+		.pages        = pages,
+		.partial      = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		/* core kernel ops: the pipe may outlive this module */
+		.ops          = &nosteal_pipe_buf_ops,
+		.spd_release  = pcd_spd_release,
+	};
+	loff_t start = *ppos, pos = start;
+	size_t count = len;
+	ssize_t retval = 0;
+
+	/* 1. adjust the length */
+	if(pos >= pcd_mem_size || !len)
+		goto out;
+	len = min_t(loff_t, len, pcd_mem_size - pos);
+
+	/* 2. collect the pages, never written pages go in as the zero page */
+	while(len && spd.nr_pages < PIPE_DEF_BUFFERS)
+	{
+		size_t offset = offset_in_page(pos);
+		size_t chunk = min_t(size_t, PAGE_SIZE - offset, len);
+		struct page *page = pcd_get_page(pos >> PAGE_SHIFT, false);
+
+		if(!page)
+			page = ZERO_PAGE(0);
+
+		get_page(page);
+		pages[spd.nr_pages] = page;
+		partial[spd.nr_pages].offset = offset;
+		partial[spd.nr_pages].len = chunk;
+		spd.nr_pages++;
+
+		pos += chunk;
+		len -= chunk;
+	}
+
+	/* 3. move them into the pipe and update the file position */
+	retval = splice_to_pipe(pipe, &spd);
+	if(retval > 0)
+		*ppos += retval;
+
+out:
+	trace_pcd_splice_read(count, start, retval);
+	return retval;
 }
 
 /* uint32_t variable to hold the major(12 bit) + minor(20 bit) number */
@@ -107,32 +676,183 @@ dev_t device_number;
 struct cdev pcd_cdev;
 struct file_operations pcd_fops =
 {
-	.open    = pcd_open,
-	.write   = pcd_write,
-	.read    = pcd_read,
-	.llseek  = pcd_llseek,
-	.release = pcd_release,
-	.owner   = THIS_MODULE
+	.open           = pcd_open,
+	.write_iter     = pcd_write_iter,
+	.read_iter      = pcd_read_iter,
+	.llseek         = pcd_llseek,
+	.mmap           = pcd_mmap,
+	.splice_read    = pcd_splice_read,
+	.splice_write   = iter_file_splice_write,
+	.unlocked_ioctl = pcd_ioctl,
+	.compat_ioctl   = compat_ptr_ioctl,
+	.uring_cmd      = pcd_uring_cmd,
+	.release        = pcd_release,
+	.owner          = THIS_MODULE
+};
+
+/* file operations used in stream_mode */
+struct file_operations pcd_fifo_fops =
+{
+	.open           = pcd_fifo_open,
+	.write          = pcd_fifo_write,
+	.read           = pcd_fifo_read,
+	.poll           = pcd_fifo_poll,
+	.release        = pcd_release,
+	.owner          = THIS_MODULE
 };
 
 /*class and device structure variable */
 struct class *pcd_class;
 struct device *pcd_device;
 
+/* sysfs attributes of pcd_device: /sys/class/pcd_class/pcd_device/stats/<name> */
+#define PCD_STAT_ATTR(_name, _field)						\
+static ssize_t _name##_show(struct device *dev, struct device_attribute *attr, char *buf) \
+{										\
+	return sysfs_emit(buf, "%llu\n", pcd_stats_sum(offsetof(struct pcd_stats, _field))); \
+}										\
+static DEVICE_ATTR_RO(_name)
+
+PCD_STAT_ATTR(reads, ops[PCD_STAT_READ]);
+PCD_STAT_ATTR(writes, ops[PCD_STAT_WRITE]);
+PCD_STAT_ATTR(bytes_read, bytes[PCD_STAT_READ]);
+PCD_STAT_ATTR(bytes_written, bytes[PCD_STAT_WRITE]);
+PCD_STAT_ATTR(short_transfers, short_xfers);
+PCD_STAT_ATTR(efaults, efaults);
+
+/* one line of PCD_HIST_BUCKETS counts, bucket n = calls that took < 2^n ns */
+static ssize_t pcd_show_hist(char *buf, enum pcd_stat_op op)
+{
+	int len = 0;
+	int i;
+
+	for(i = 0; i < PCD_HIST_BUCKETS; i++)
+		len += sysfs_emit_at(buf, len, "%llu%c",
+				     pcd_stats_sum(offsetof(struct pcd_stats, latency_hist[op][i])),
+				     i == PCD_HIST_BUCKETS - 1 ? '\n' : ' ');
+	return len;
+}
+
+static ssize_t read_latency_hist_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return pcd_show_hist(buf, PCD_STAT_READ);
+}
+static DEVICE_ATTR_RO(read_latency_hist);
+
+static ssize_t write_latency_hist_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	return pcd_show_hist(buf, PCD_STAT_WRITE);
+}
+static DEVICE_ATTR_RO(write_latency_hist);
+
+static struct attribute *pcd_stats_attrs[] =
+{
+	&dev_attr_reads.attr,
+	&dev_attr_writes.attr,
+	&dev_attr_bytes_read.attr,
+	&dev_attr_bytes_written.attr,
+	&dev_attr_short_transfers.attr,
+	&dev_attr_efaults.attr,
+	&dev_attr_read_latency_hist.attr,
+	&dev_attr_write_latency_hist.attr,
+	NULL
+};
+
+static const struct attribute_group pcd_stats_group =
+{
+	.name  = "stats",
+	.attrs = pcd_stats_attrs,
+};
+
+static const struct attribute_group *pcd_device_groups[] =
+{
+	&pcd_stats_group,
+	NULL
+};
+
+/* debugfs: any write to /sys/kernel/debug/pcd/reset_stats clears the counters */
+struct dentry *pcd_debugfs_dir;
+
+static ssize_t pcd_reset_stats_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+{
+	int cpu;
+
+	/* a read/write racing with the reset may survive it, that is fine for statistics */
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&pcd_stats, cpu), 0, sizeof(struct pcd_stats));
+	return count;
+}
+
+static const struct file_operations pcd_reset_stats_fops =
+{
+	.open  = simple_open,
+	.write = pcd_reset_stats_write,
+	.owner = THIS_MODULE
+};
+
+/* release the fifo, or every page that was populated and then the page table itself */
+static void pcd_free_mem(void)
+{
+	unsigned long i;
+
+	if(stream_mode)
+	{
+		kfifo_free(&pcd_fifo);
+		return;
+	}
+
+	for(i = 0; i < pcd_nr_pages; i++)
+		if(pcd_pages[i])
+			__free_page(pcd_pages[i]);
+	kvfree(pcd_pages);
+}
+
 /* Module insertion section */
 static int __init pcd_module_init(void)
 {
 	int retval;
+
+	/* 0. size the device memory */
+	pcd_mem_size = mem_size ? memparse(mem_size, NULL) : DEV_MEM_SIZE;
+	if(pcd_mem_size <= 0 || (stream_mode && pcd_mem_size > KMALLOC_MAX_SIZE))
+	{
+		pr_err("invalid mem_size %s\n", mem_size);
+		retval = -EINVAL;
+		goto exit;
+	}
+
+	if(stream_mode)
+	{
+		/* 0(i) stream mode: the ring buffer is the device memory */
+		retval = kfifo_alloc(&pcd_fifo, pcd_mem_size, GFP_KERNEL);
+		if(retval)
+			goto exit;
+		pr_info("fifo mode: %u bytes\r\n", kfifo_size(&pcd_fifo));
+	}
+	else
+	{
+		/* 0(ii) memory mode: allocate the page table, pages come later */
+		pcd_nr_pages = DIV_ROUND_UP(pcd_mem_size, PAGE_SIZE);
+
+		pcd_pages = kvcalloc(pcd_nr_pages, sizeof(*pcd_pages), GFP_KERNEL);
+		if(!pcd_pages)
+		{
+			retval = -ENOMEM;
+			goto exit;
+		}
+		pr_info("device memory: %lld bytes (%lu pages)\r\n", pcd_mem_size, pcd_nr_pages);
+	}
+
 	/* 1. dynamically creating the major & minor numbers */
 	retval = alloc_chrdev_region(&device_number, 0, 1, "pcd");
 		if(retval < 0)
-			goto exit;
+			goto free_buffer;
 
 	/* printing the major & minor numbers */
 	pr_info("Major : %d Minor : %d\r\n", MAJOR(device_number), MINOR(device_number));
 
 	/* 2. registration of the major & minor numbers  with the VFS (virtual file system) */
-	cdev_init(&pcd_cdev, &pcd_fops);
+	cdev_init(&pcd_cdev, stream_mode ? &pcd_fifo_fops : &pcd_fops);
 
 	/* 2(i) owner init */
 	pcd_cdev.owner = THIS_MODULE;
@@ -150,7 +870,8 @@ static int __init pcd_module_init(void)
 		retval = PTR_ERR(pcd_class);
 		goto cdev_del;
 	}
-	pcd_device = device_create(pcd_class, NULL, device_number, NULL, "pcd_device");
+	pcd_device = device_create_with_groups(pcd_class, NULL, device_number, NULL,
+					       pcd_device_groups, "pcd_device");
 	if(IS_ERR(pcd_device))
 	{
 		pr_err("device create failed\n");
@@ -158,6 +879,10 @@ static int __init pcd_module_init(void)
 		goto class_destroy;
 	}
 
+	/* 4. debugfs control files, failures here are not fatal */
+	pcd_debugfs_dir = debugfs_create_dir("pcd", NULL);
+	debugfs_create_file("reset_stats", 0200, pcd_debugfs_dir, NULL, &pcd_reset_stats_fops);
+
 	pr_info("pcd module init successfully \r\n");
 	return 0;
 
@@ -170,6 +895,9 @@ cdev_del:
 unreg_device:
 	unregister_chrdev_region(device_number, 1);
 
+free_buffer:
+	pcd_free_mem();
+
 exit:
 	pr_info("Module insertion failed!\n");
 	return retval;
@@ -178,10 +906,12 @@ exit:
 /* Module exit section */
 static void __exit pcd_module_exit(void)
 {
+	debugfs_remove_recursive(pcd_debugfs_dir);
 	device_destroy(pcd_class, device_number);
 	class_destroy(pcd_class);
 	cdev_del(&pcd_cdev);
 	unregister_chrdev_region(device_number, 1);
+	pcd_free_mem();
 	pr_info("pcd module exited successfully\r\n");
 }
 
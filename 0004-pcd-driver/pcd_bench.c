@@ -0,0 +1,388 @@
+/*
+ * pcd_bench.c - user space benchmark for the pcd driver
+ *
+ * Compares read()/write() on /dev/pcd_device against plain memory
+ * access through an mmap() of the same device buffer, and a
+ * header + payload record sent as two write() calls against one writev().
+ *
+ * -t N runs a concurrency stress test instead: 1, 2, 4 ... N reader
+ * threads pread() the device while one writer keeps rewriting it with a
+ * uniform byte pattern. Reader throughput is reported per thread count,
+ * and any read that returns a mix of two patterns counts as torn.
+ *
+ * -b N compares one pread()/pwrite() per record against PCD_IOC_BATCH
+ * ioctls carrying N records each, for record sizes from 8 B to 4 KB.
+ *
+ * build : make bench
+ * usage : sudo ./pcd_bench [-t threads | -b batch] [device] [iterations] [max_size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "pcd_ioctl.h"
+
+#define DEFAULT_DEVICE      "/dev/pcd_device"
+#define DEFAULT_ITERATIONS  100000
+#define DEFAULT_MAX_SIZE    (4 * 1024 * 1024)
+#define RECORD_HEADER_SIZE  16
+#define STRESS_IO_SIZE      (64 * 1024)
+#define BATCH_MIN_RECORD    8
+#define BATCH_MAX_RECORD    4096
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *name, size_t size, long iterations, unsigned long long ns)
+{
+	double ns_op = (double)ns / iterations;
+	double mb_s  = ((double)size * iterations) / ((double)ns / 1e9) / (1024 * 1024);
+
+	printf("%-12s %10zu %12.1f %12.1f\n", name, size, ns_op, mb_s);
+}
+
+struct stress_reader {
+	pthread_t thread;
+	int fd;
+	size_t size;
+	long iterations;
+	long torn;
+};
+
+static volatile int stop_writer;
+
+/* keep rewriting the device with buffers of one repeated byte value */
+static void *stress_writer(void *p)
+{
+	struct stress_reader *w = p;
+	char *buf = malloc(w->size);
+	unsigned char value = 0;
+
+	while (buf && !stop_writer) {
+		memset(buf, value++, w->size);
+		if (pwrite(w->fd, buf, w->size, 0) != (ssize_t)w->size) {
+			perror("pwrite");
+			break;
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+/* read the device back and check that every buffer holds a single byte value */
+static void *stress_reader(void *p)
+{
+	struct stress_reader *r = p;
+	char *buf = malloc(r->size);
+	size_t j;
+	long i;
+
+	for (i = 0; buf && i < r->iterations; i++) {
+		if (pread(r->fd, buf, r->size, 0) != (ssize_t)r->size) {
+			perror("pread");
+			break;
+		}
+		for (j = 1; j < r->size; j++)
+			if (buf[j] != buf[0]) {
+				r->torn++;
+				break;
+			}
+	}
+	free(buf);
+	return NULL;
+}
+
+static int stress(int fd, size_t size, long iterations, int max_threads)
+{
+	struct stress_reader *readers = calloc(max_threads, sizeof(*readers));
+	struct stress_reader writer = { .fd = fd, .size = size };
+	unsigned long long start, ns;
+	long torn;
+	int nr, t;
+
+	if (!readers) {
+		perror("calloc");
+		return 1;
+	}
+
+	printf("stress: %zu byte reads, %ld per thread, one concurrent writer\n", size, iterations);
+	printf("%8s %14s %12s %8s\n", "readers", "reads/s", "MB/s", "torn");
+
+	for (nr = 1; nr <= max_threads; nr <<= 1) {
+		stop_writer = 0;
+		pthread_create(&writer.thread, NULL, stress_writer, &writer);
+
+		start = now_ns();
+		for (t = 0; t < nr; t++) {
+			readers[t] = (struct stress_reader){ .fd = fd, .size = size, .iterations = iterations };
+			pthread_create(&readers[t].thread, NULL, stress_reader, &readers[t]);
+		}
+		for (t = 0, torn = 0; t < nr; t++) {
+			pthread_join(readers[t].thread, NULL);
+			torn += readers[t].torn;
+		}
+		ns = now_ns() - start;
+
+		stop_writer = 1;
+		pthread_join(writer.thread, NULL);
+
+		printf("%8d %14.0f %12.1f %8ld\n", nr,
+		       (double)nr * iterations / ((double)ns / 1e9),
+		       (double)nr * iterations * size / ((double)ns / 1e9) / (1024 * 1024),
+		       torn);
+	}
+
+	free(readers);
+	return 0;
+}
+
+/* run nr_records records of one direction, as pread()/pwrite() calls when batch is 0, else as batched ioctls */
+static int batch_run(int fd, int op, char *buf, size_t size, off_t span,
+		     long nr_records, struct pcd_batch_op *ops, int batch)
+{
+	struct pcd_batch req = { .ops = (uintptr_t)ops };
+	long done, n;
+	ssize_t ret;
+
+	for (done = 0; done < nr_records; done += n) {
+		if (!batch) {
+			off_t offset = (done * size) % span;
+
+			n = 1;
+			ret = op == PCD_OP_WRITE ? pwrite(fd, buf, size, offset)
+						 : pread(fd, buf, size, offset);
+			if (ret != (ssize_t)size) {
+				perror(op == PCD_OP_WRITE ? "pwrite" : "pread");
+				return -1;
+			}
+			continue;
+		}
+
+		n = nr_records - done < batch ? nr_records - done : batch;
+		for (long k = 0; k < n; k++) {
+			ops[k] = (struct pcd_batch_op){
+				.op     = op,
+				.offset = ((done + k) * size) % span,
+				.len    = size,
+				.addr   = (uintptr_t)(buf + k * size),
+			};
+		}
+		req.nr_ops = n;
+		if (ioctl(fd, PCD_IOC_BATCH, &req)) {
+			perror("PCD_IOC_BATCH");
+			return -1;
+		}
+		for (long k = 0; k < n; k++)
+			if (ops[k].result != (__s64)size) {
+				fprintf(stderr, "batch entry %ld: %lld\n", k, (long long)ops[k].result);
+				return -1;
+			}
+	}
+	return 0;
+}
+
+static int batch_bench(int fd, off_t dev_size, long iterations, int batch)
+{
+	struct pcd_batch_op *ops = calloc(batch, sizeof(*ops));
+	char *buf = malloc((size_t)batch * BATCH_MAX_RECORD);
+	unsigned long long start, ns_plain, ns_batch;
+	size_t size;
+	off_t span;
+	int op;
+
+	if (!ops || !buf) {
+		perror("malloc");
+		return 1;
+	}
+	memset(buf, 0x5a, (size_t)batch * BATCH_MAX_RECORD);
+
+	printf("batch: %ld records per run, %d records per ioctl\n", iterations, batch);
+	printf("%-6s %8s %14s %14s %8s\n", "op", "record", "syscall ops/s", "batch ops/s", "speedup");
+
+	for (size = BATCH_MIN_RECORD; size <= BATCH_MAX_RECORD; size <<= 1) {
+		if (size > (size_t)dev_size)
+			break;
+		/* records land back to back and wrap around inside the device */
+		span = dev_size / size * size;
+
+		for (op = PCD_OP_READ; op <= PCD_OP_WRITE; op++) {
+			start = now_ns();
+			if (batch_run(fd, op, buf, size, span, iterations, ops, 0))
+				return 1;
+			ns_plain = now_ns() - start;
+
+			start = now_ns();
+			if (batch_run(fd, op, buf, size, span, iterations, ops, batch))
+				return 1;
+			ns_batch = now_ns() - start;
+
+			printf("%-6s %8zu %14.0f %14.0f %7.2fx\n",
+			       op == PCD_OP_WRITE ? "write" : "read", size,
+			       iterations / ((double)ns_plain / 1e9),
+			       iterations / ((double)ns_batch / 1e9),
+			       (double)ns_plain / ns_batch);
+		}
+	}
+
+	free(ops);
+	free(buf);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t threads | -b batch] [device] [iterations] [max_size]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *device = DEFAULT_DEVICE;
+	long iterations = DEFAULT_ITERATIONS;
+	off_t max_size = DEFAULT_MAX_SIZE;
+	int threads = 0, batch = 0;
+	char header[RECORD_HEADER_SIZE] = { 0 };
+	struct iovec iov[2];
+	unsigned long long start;
+	volatile char sink;
+	char *map, *buf;
+	off_t dev_size;
+	size_t size;
+	long i;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "t:b:h")) != -1) {
+		switch (opt) {
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			if (batch < 1 || batch > PCD_BATCH_MAX) {
+				fprintf(stderr, "batch must be 1..%d\n", PCD_BATCH_MAX);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		device = argv[optind++];
+	if (optind < argc)
+		iterations = atol(argv[optind++]);
+	if (optind < argc)
+		max_size = atoll(argv[optind++]);
+
+	fd = open(device, O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+
+	/* SEEK_END on the pcd device reports the buffer size */
+	dev_size = lseek(fd, 0, SEEK_END);
+	if (dev_size <= 0) {
+		perror("lseek");
+		return 1;
+	}
+	if (dev_size > max_size)
+		dev_size = max_size;
+
+	if (threads > 0)
+		return stress(fd, dev_size < STRESS_IO_SIZE ? dev_size : STRESS_IO_SIZE,
+			      iterations, threads);
+
+	if (batch > 0)
+		return batch_bench(fd, dev_size, iterations, batch);
+
+	map = mmap(NULL, dev_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	buf = malloc(dev_size);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	memset(buf, 0xa5, dev_size);
+
+	printf("device %s, %lld bytes, %ld iterations\n", device, (long long)dev_size, iterations);
+	printf("%-12s %10s %12s %12s\n", "method", "bytes", "ns/op", "MB/s");
+
+	for (size = 64; size <= (size_t)dev_size; size <<= 1) {
+		start = now_ns();
+		for (i = 0; i < iterations; i++)
+			if (pwrite(fd, buf, size, 0) != (ssize_t)size) {
+				perror("pwrite");
+				return 1;
+			}
+		report("write()", size, iterations, now_ns() - start);
+
+		start = now_ns();
+		for (i = 0; i < iterations; i++)
+			memcpy(map, buf, size);
+		report("mmap store", size, iterations, now_ns() - start);
+
+		start = now_ns();
+		for (i = 0; i < iterations; i++)
+			if (pread(fd, buf, size, 0) != (ssize_t)size) {
+				perror("pread");
+				return 1;
+			}
+		report("read()", size, iterations, now_ns() - start);
+
+		start = now_ns();
+		for (i = 0; i < iterations; i++) {
+			memcpy(buf, map, size);
+			sink = buf[size - 1];
+		}
+		report("mmap load", size, iterations, now_ns() - start);
+
+		/* one record = header + payload, it has to fit in the device */
+		if (size + sizeof(header) > (size_t)dev_size)
+			continue;
+
+		start = now_ns();
+		for (i = 0; i < iterations; i++)
+			if (pwrite(fd, header, sizeof(header), 0) != sizeof(header) ||
+			    pwrite(fd, buf, size, sizeof(header)) != (ssize_t)size) {
+				perror("pwrite");
+				return 1;
+			}
+		report("2x write()", size + sizeof(header), iterations, now_ns() - start);
+
+		iov[0].iov_base = header;
+		iov[0].iov_len  = sizeof(header);
+		iov[1].iov_base = buf;
+		iov[1].iov_len  = size;
+		start = now_ns();
+		for (i = 0; i < iterations; i++)
+			if (pwritev(fd, iov, 2, 0) != (ssize_t)(size + sizeof(header))) {
+				perror("pwritev");
+				return 1;
+			}
+		report("writev()", size + sizeof(header), iterations, now_ns() - start);
+	}
+	(void)sink;
+
+	munmap(map, dev_size);
+	free(buf);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * pcd_ioctl.h - ioctl interface of the pcd driver, shared by the driver
+ * and user space programs.
+ */
+#ifndef _PCD_IOCTL_H
+#define _PCD_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* pcd_batch_op.op */
+#define PCD_OP_READ    0
+#define PCD_OP_WRITE   1
+
+/* one positional read or write, like pread()/pwrite() */
+struct pcd_batch_op
+{
+	__u32 op;       /* PCD_OP_READ or PCD_OP_WRITE */
+	__u32 flags;    /* reserved, must be 0 */
+	__u64 offset;   /* device offset */
+	__u64 len;      /* bytes to move */
+	__u64 addr;     /* user buffer */
+	__s64 result;   /* out: bytes moved or -errno */
+};
+
+/* a batch of ops executed in order in one kernel entry */
+struct pcd_batch
+{
+	__u64 ops;      /* user pointer to an array of struct pcd_batch_op */
+	__u32 nr_ops;   /* number of entries, at most PCD_BATCH_MAX */
+	__u32 flags;    /* reserved, must be 0 */
+};
+
+#define PCD_BATCH_MAX   1024
+
+#define PCD_IOC_MAGIC   'p'
+#define PCD_IOC_BATCH   _IOW(PCD_IOC_MAGIC, 1, struct pcd_batch)
+
+/*
+ * io_uring passthrough: IORING_OP_URING_CMD with cmd_op = PCD_URING_CMD_RW
+ * and one struct pcd_batch_op in the sqe command area. The ring must be set
+ * up with IORING_SETUP_SQE128. The result field is ignored, the outcome is
+ * posted as cqe->res.
+ */
+#define PCD_URING_CMD_RW   _IOW(PCD_IOC_MAGIC, 2, struct pcd_batch_op)
+
+#endif /* _PCD_IOCTL_H */
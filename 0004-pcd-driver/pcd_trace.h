@@ -0,0 +1,135 @@
+/* tracepoints of the pcd driver, see /sys/kernel/tracing/events/pcd/ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pcd
+
+#if !defined(_PCD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PCD_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+
+/* open/release: which device, how it was opened and the result */
+DECLARE_EVENT_CLASS(pcd_file,
+
+	TP_PROTO(struct inode *inode, struct file *filp, int ret),
+
+	TP_ARGS(inode, filp, ret),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(unsigned int,	flags)
+		__field(int,		ret)
+	),
+
+	TP_fast_assign(
+		__entry->dev	= inode->i_rdev;
+		__entry->flags	= filp->f_flags;
+		__entry->ret	= ret;
+	),
+
+	TP_printk("dev=%d:%d flags=0x%x ret=%d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->flags, __entry->ret)
+);
+
+DEFINE_EVENT(pcd_file, pcd_open,
+	TP_PROTO(struct inode *inode, struct file *filp, int ret),
+	TP_ARGS(inode, filp, ret)
+);
+
+DEFINE_EVENT(pcd_file, pcd_release,
+	TP_PROTO(struct inode *inode, struct file *filp, int ret),
+	TP_ARGS(inode, filp, ret)
+);
+
+/* data transfers: requested count, starting offset and bytes moved or -errno */
+DECLARE_EVENT_CLASS(pcd_io,
+
+	TP_PROTO(size_t count, loff_t pos, ssize_t ret),
+
+	TP_ARGS(count, pos, ret),
+
+	TP_STRUCT__entry(
+		__field(size_t,		count)
+		__field(loff_t,		pos)
+		__field(ssize_t,	ret)
+	),
+
+	TP_fast_assign(
+		__entry->count	= count;
+		__entry->pos	= pos;
+		__entry->ret	= ret;
+	),
+
+	TP_printk("count=%zu pos=%lld ret=%zd",
+		  __entry->count, __entry->pos, __entry->ret)
+);
+
+DEFINE_EVENT(pcd_io, pcd_read,
+	TP_PROTO(size_t count, loff_t pos, ssize_t ret),
+	TP_ARGS(count, pos, ret)
+);
+
+DEFINE_EVENT(pcd_io, pcd_write,
+	TP_PROTO(size_t count, loff_t pos, ssize_t ret),
+	TP_ARGS(count, pos, ret)
+);
+
+DEFINE_EVENT(pcd_io, pcd_splice_read,
+	TP_PROTO(size_t count, loff_t pos, ssize_t ret),
+	TP_ARGS(count, pos, ret)
+);
+
+TRACE_EVENT(pcd_llseek,
+
+	TP_PROTO(loff_t offset, int whence, loff_t ret),
+
+	TP_ARGS(offset, whence, ret),
+
+	TP_STRUCT__entry(
+		__field(loff_t,	offset)
+		__field(int,	whence)
+		__field(loff_t,	ret)
+	),
+
+	TP_fast_assign(
+		__entry->offset	= offset;
+		__entry->whence	= whence;
+		__entry->ret	= ret;
+	),
+
+	TP_printk("offset=%lld whence=%d ret=%lld",
+		  __entry->offset, __entry->whence, __entry->ret)
+);
+
+/* mmap: first page offset and length of the mapping, 0 or -errno */
+TRACE_EVENT(pcd_mmap,
+
+	TP_PROTO(unsigned long pgoff, unsigned long nr_pages, int ret),
+
+	TP_ARGS(pgoff, nr_pages, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned long,	pgoff)
+		__field(unsigned long,	nr_pages)
+		__field(int,		ret)
+	),
+
+	TP_fast_assign(
+		__entry->pgoff		= pgoff;
+		__entry->nr_pages	= nr_pages;
+		__entry->ret		= ret;
+	),
+
+	TP_printk("pgoff=%lu nr_pages=%lu ret=%d",
+		  __entry->pgoff, __entry->nr_pages, __entry->ret)
+);
+
+#endif /* _PCD_TRACE_H */
+
+/* this part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pcd_trace
+#include <trace/define_trace.h>
@@ -1,61 +1,408 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/configfs.h>
+#include <linux/idr.h>
+#include <linux/mutex.h>
 #include "platform.h"
 
+/*
+ * Registers num_devices pcd platform devices and reports how long it took to
+ * register them (and, with the driver loaded, to probe them) and to remove
+ * them again. Stress test with 10k instances:
+ *   insmod pcd_platform_driver.ko
+ *   insmod pcd_device_setup.ko num_devices=10000
+ *   rmmod pcd_device_setup
+ *   dmesg | grep "device setup"
+ *
+ * Load time with the devices already registered, asynchronous vs synchronous
+ * probing. probe_time_us is from driver init until the last probe returned,
+ * load_time_us until the last buffer is zeroed:
+ *   insmod pcd_device_setup.ko num_devices=500 dev_size=1048576
+ *   insmod pcd_platform_driver.ko [sync_probe=1] [async_probe=1]
+ *   cat /sys/class/pcd_class/probe_time_us /sys/class/pcd_class/load_time_us
+ *   cat /sys/class/pcd_class/total_devices
+ * Asynchronous probes run in parallel, but insmod waits for all of them
+ * (async_synchronize_full() in module loading) unless async_probe=1 is
+ * given. Without it, insmod returns only after every probe is done in both
+ * modes: asynchronous probing gains from running the probes in parallel, not
+ * from an earlier return.
+ *
+ * More instances can be created at run time through configfs, see the
+ * "configfs interface" section below.
+ */
 
+/*1. the first devices keep their well known platform data */
+struct pcdev_platform_data pcdev_data[2]=
+{
+	[0] = {.size= 512,   .perm = RDWR, .serial_number = "PCDEV0011AA"},
+	[1] = {.size = 1024, .perm = RDWR, .serial_number = "PCDEV0022BB"}
+};
+
+/*2. number of platform devices to create and their memory size */
+unsigned int num_devices = 2;
+module_param(num_devices, uint, S_IRUSR);
+MODULE_PARM_DESC(num_devices, "number of pcd platform devices to create (default 2)");
+
+int dev_size = 512;
+module_param(dev_size, int, S_IRUSR);
+MODULE_PARM_DESC(dev_size, "memory size of the devices beyond the first two (default 512)");
 
-/* platform device release function */
-void pcdev_release(struct device *dev)
+/* the registered platform devices */
+struct platform_device **pcdevs;
+
+/*
+ * configfs interface: /sys/kernel/config/pcd/<name>
+ *
+ *   mkdir /sys/kernel/config/pcd/dev0        creates an item (dev_size bytes, rw, serial "dev0")
+ *   echo 4096 > /sys/kernel/config/pcd/dev0/size
+ *   echo ro > /sys/kernel/config/pcd/dev0/perm
+ *   echo SN1234 > /sys/kernel/config/pcd/dev0/serial
+ *   echo 1 > /sys/kernel/config/pcd/dev0/enable    registers the device
+ *   echo 0 > /sys/kernel/config/pcd/dev0/enable    unregisters it again
+ *   rmdir /sys/kernel/config/pcd/dev0        removes the item (and the device)
+ *
+ * Platform data is fixed once a device is registered, so size, perm and
+ * serial only stage the values and fail with -EBUSY while the item is
+ * enabled. Disable, change and enable again to re-create the device.
+ */
+struct pcdev_item
+{
+	struct config_item item;
+	struct pcdev_platform_data pdata;
+	struct platform_device *pdev;
+	int id;
+	struct mutex lock;
+};
+
+/* ids of configfs devices start after the ones created at load time */
+DEFINE_IDA(pcdev_ida);
+
+static inline struct pcdev_item *to_pcdev_item(struct config_item *item)
 {
-	pr_info("device setup module is relesed!\r\n");
+	return container_of(item, struct pcdev_item, item);
 }
 
-/*1. creating the platfrom data with 2 instances*/
+/* register the platform device of an item, called with pi->lock held */
+static int pcdev_item_register(struct pcdev_item *pi)
+{
+	pi->id = ida_alloc_min(&pcdev_ida, num_devices, GFP_KERNEL);
+	if(pi->id < 0)
+		return pi->id;
+
+	pi->pdev = platform_device_register_data(NULL, "pcd-char-device", pi->id,
+						 &pi->pdata, sizeof(pi->pdata));
+	if(IS_ERR(pi->pdev))
+	{
+		int ret = PTR_ERR(pi->pdev);
 
-struct pcdev_platform_data pcdev_data[2]=
+		pi->pdev = NULL;
+		ida_free(&pcdev_ida, pi->id);
+		return ret;
+	}
+	return 0;
+}
+
+/* unregister the platform device of an item, called with pi->lock held */
+static void pcdev_item_unregister(struct pcdev_item *pi)
 {
-	[0] = {.size= 512,   .perm = RDWR, .serial_number = "PCDEV0011AA"},
-	[1] = {.size = 1024, .perm = RDWR, .serial_number = "PCDEV0022BB"}
-};
+	if(!pi->pdev)
+		return;
+
+	platform_device_unregister(pi->pdev);
+	ida_free(&pcdev_ida, pi->id);
+	pi->pdev = NULL;
+}
 
-/*2. first platfrom device */
-struct platform_device platform_pcdev_1 ={
-	.name = "pcd-char-device",
-	.id = 0,
-	.dev = {
-		.platform_data = &pcdev_data[0],
-		.release = pcdev_release
+/*
+ * take pi->lock to stage one field of the platform data, fails while a
+ * device is registered. Each store only assigns its own field under the
+ * lock, so concurrent writes to different attributes do not undo each other.
+ */
+static int pcdev_item_lock_staged(struct pcdev_item *pi)
+{
+	mutex_lock(&pi->lock);
+	if(pi->pdev)
+	{
+		mutex_unlock(&pi->lock);
+		return -EBUSY;
 	}
-};
+	return 0;
+}
+
+static ssize_t pcdev_item_size_show(struct config_item *item, char *page)
+{
+	return sprintf(page, "%d\n", to_pcdev_item(item)->pdata.size);
+}
+
+static ssize_t pcdev_item_size_store(struct config_item *item, const char *page, size_t count)
+{
+	struct pcdev_item *pi = to_pcdev_item(item);
+	int size;
+	int ret;
 
-/* 2nd platform device */
-struct platform_device platform_pcdev_2 ={
-	.name = "pcd-char-device",
-	.id = 1,
-	.dev = {
-		.platform_data = &pcdev_data[1],
-		.release = pcdev_release
+	ret = kstrtoint(page, 0, &size);
+	if(ret)
+		return ret;
+	if(size <= 0)
+		return -EINVAL;
+
+	ret = pcdev_item_lock_staged(pi);
+	if(ret)
+		return ret;
+	pi->pdata.size = size;
+	mutex_unlock(&pi->lock);
+	return count;
+}
+
+static ssize_t pcdev_item_perm_show(struct config_item *item, char *page)
+{
+	switch(to_pcdev_item(item)->pdata.perm)
+	{
+		case RDONLY:
+			return sprintf(page, "ro\n");
+		case WRONLY:
+			return sprintf(page, "wo\n");
+		default:
+			return sprintf(page, "rw\n");
 	}
+}
+
+static ssize_t pcdev_item_perm_store(struct config_item *item, const char *page, size_t count)
+{
+	struct pcdev_item *pi = to_pcdev_item(item);
+	int perm;
+	int ret;
+
+	if(sysfs_streq(page, "rw"))
+		perm = RDWR;
+	else if(sysfs_streq(page, "ro"))
+		perm = RDONLY;
+	else if(sysfs_streq(page, "wo"))
+		perm = WRONLY;
+	else
+		return -EINVAL;
+
+	ret = pcdev_item_lock_staged(pi);
+	if(ret)
+		return ret;
+	pi->pdata.perm = perm;
+	mutex_unlock(&pi->lock);
+	return count;
+}
+
+static ssize_t pcdev_item_serial_show(struct config_item *item, char *page)
+{
+	struct pcdev_item *pi = to_pcdev_item(item);
+	ssize_t ret;
+
+	/* a string, it can be torn by a concurrent store */
+	mutex_lock(&pi->lock);
+	ret = sprintf(page, "%s\n", pi->pdata.serial_number);
+	mutex_unlock(&pi->lock);
+	return ret;
+}
+
+static ssize_t pcdev_item_serial_store(struct config_item *item, const char *page, size_t count)
+{
+	struct pcdev_item *pi = to_pcdev_item(item);
+	char serial[sizeof(pi->pdata.serial_number)];
+	int ret;
+
+	if(strscpy(serial, page, sizeof(serial)) < 0)
+		return -EINVAL;
+
+	ret = pcdev_item_lock_staged(pi);
+	if(ret)
+		return ret;
+	strscpy(pi->pdata.serial_number, strim(serial), sizeof(pi->pdata.serial_number));
+	mutex_unlock(&pi->lock);
+	return count;
+}
+
+static ssize_t pcdev_item_enable_show(struct config_item *item, char *page)
+{
+	return sprintf(page, "%d\n", !!READ_ONCE(to_pcdev_item(item)->pdev));
+}
+
+/* register the device with the staged platform data, or unregister it */
+static ssize_t pcdev_item_enable_store(struct config_item *item, const char *page, size_t count)
+{
+	struct pcdev_item *pi = to_pcdev_item(item);
+	bool enable;
+	int ret;
+
+	ret = kstrtobool(page, &enable);
+	if(ret)
+		return ret;
+
+	mutex_lock(&pi->lock);
+	if(enable && !pi->pdev)
+		ret = pcdev_item_register(pi);
+	else if(!enable)
+		pcdev_item_unregister(pi);
+	mutex_unlock(&pi->lock);
+
+	return ret ? ret : count;
+}
+
+CONFIGFS_ATTR(pcdev_item_, size);
+CONFIGFS_ATTR(pcdev_item_, perm);
+CONFIGFS_ATTR(pcdev_item_, serial);
+CONFIGFS_ATTR(pcdev_item_, enable);
+
+static struct configfs_attribute *pcdev_item_attrs[] =
+{
+	&pcdev_item_attr_size,
+	&pcdev_item_attr_perm,
+	&pcdev_item_attr_serial,
+	&pcdev_item_attr_enable,
+	NULL,
+};
+
+/* last reference to the item is gone (rmdir): remove the device */
+static void pcdev_item_release(struct config_item *item)
+{
+	struct pcdev_item *pi = to_pcdev_item(item);
+
+	mutex_lock(&pi->lock);
+	pcdev_item_unregister(pi);
+	mutex_unlock(&pi->lock);
+	kfree(pi);
+}
+
+static struct configfs_item_operations pcdev_item_ops =
+{
+	.release = pcdev_item_release,
+};
+
+static const struct config_item_type pcdev_item_type =
+{
+	.ct_item_ops = &pcdev_item_ops,
+	.ct_attrs    = pcdev_item_attrs,
+	.ct_owner    = THIS_MODULE,
+};
+
+/* mkdir: create a disabled item with default platform data */
+static struct config_item *pcdev_make_item(struct config_group *group, const char *name)
+{
+	struct pcdev_item *pi;
+
+	pi = kzalloc(sizeof(*pi), GFP_KERNEL);
+	if(!pi)
+		return ERR_PTR(-ENOMEM);
+
+	mutex_init(&pi->lock);
+	pi->pdata.size = dev_size;
+	pi->pdata.perm = RDWR;
+	strscpy(pi->pdata.serial_number, name, sizeof(pi->pdata.serial_number));
+
+	config_item_init_type_name(&pi->item, name, &pcdev_item_type);
+	return &pi->item;
+}
+
+static struct configfs_group_operations pcdev_group_ops =
+{
+	.make_item = pcdev_make_item,
+};
+
+static const struct config_item_type pcdev_group_type =
+{
+	.ct_group_ops = &pcdev_group_ops,
+	.ct_owner     = THIS_MODULE,
+};
+
+struct configfs_subsystem pcdev_subsys =
+{
+	.su_group = {
+		.cg_item = {
+			.ci_namebuf = "pcd",
+			.ci_type    = &pcdev_group_type,
+		},
+	},
 };
 
 /* Module load entry point*/
 static int __init pcdev_platform_init(void)
 {
-	/* register platform device */
-	platform_device_register(&platform_pcdev_1);
-	platform_device_register(&platform_pcdev_2);
+	struct pcdev_platform_data pdata = { .perm = RDWR };
+	ktime_t start;
+	unsigned int i;
+	int ret;
 
-	pr_info("device setup module is inserted\r\n");
+	pcdevs = kcalloc(num_devices, sizeof(*pcdevs), GFP_KERNEL);
+	if(!pcdevs)
+		return -ENOMEM;
+
+	start = ktime_get();
+
+	/*
+	 * register platform device, the platform data is copied into every
+	 * device, so one template on the stack serves all of them
+	 */
+	for(i = 0; i < num_devices; i++)
+	{
+		if(i < ARRAY_SIZE(pcdev_data))
+		{
+			pdata = pcdev_data[i];
+		}
+		else
+		{
+			pdata.size = dev_size;
+			snprintf(pdata.serial_number, sizeof(pdata.serial_number), "PCDEV%06u", i);
+		}
+
+		pcdevs[i] = platform_device_register_data(NULL, "pcd-char-device", i,
+							  &pdata, sizeof(pdata));
+		if(IS_ERR(pcdevs[i]))
+		{
+			ret = PTR_ERR(pcdevs[i]);
+			pr_err("platform device %u register failed!\r\n", i);
+			goto unregister_devices;
+		}
+	}
+
+	pr_info("device setup module is inserted: %u devices registered in %lld us\r\n",
+		num_devices, ktime_us_delta(ktime_get(), start));
+
+	/* run time instances through /sys/kernel/config/pcd */
+	config_group_init(&pcdev_subsys.su_group);
+	mutex_init(&pcdev_subsys.su_mutex);
+	ret = configfs_register_subsystem(&pcdev_subsys);
+	if(ret)
+	{
+		pr_err("configfs register failed!\r\n");
+		goto unregister_devices;
+	}
 	return 0;
+
+unregister_devices:
+	while(i--)
+		platform_device_unregister(pcdevs[i]);
+	kfree(pcdevs);
+	return ret;
 }
 
 /*module exit function*/
 static void __exit pcdev_platform_exit(void)
 {
-	/*unregister the platfrom device */
-	platform_device_unregister(&platform_pcdev_1);
-	platform_device_unregister(&platform_pcdev_2);
-	pr_info("device setup module is module removed!\r\n");
+	ktime_t start;
+	unsigned int i;
+
+	/* configfs devices are gone already, the module is pinned while any exists */
+	configfs_unregister_subsystem(&pcdev_subsys);
+
+	start = ktime_get();
+
+	/*unregister the platfrom device, newest first */
+	for(i = num_devices; i--; )
+		platform_device_unregister(pcdevs[i]);
+	kfree(pcdevs);
+
+	pr_info("device setup module is module removed: %u devices unregistered in %lld us\r\n",
+		num_devices, ktime_us_delta(ktime_get(), start));
 }
 
 /*Module registartion macro*/
@@ -6,66 +6,226 @@
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 #include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/idr.h>
+#include <linux/xarray.h>
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
 #include "platform.h"
 
-#define MAX_DEVICES  2U
+/* default number of minors reserved for pcd devices */
+#define MAX_DEVICES  16384U
 
+unsigned int max_devices = MAX_DEVICES;
+module_param(max_devices, uint, S_IRUSR);
+MODULE_PARM_DESC(max_devices, "maximum number of pcd devices (default 16384)");
 
-/* Device privet data structure */
+/* probe devices one by one instead of in parallel, to compare load times */
+bool sync_probe;
+module_param(sync_probe, bool, S_IRUSR);
+MODULE_PARM_DESC(sync_probe, "probe devices synchronously (default: asynchronous)");
+
+/*
+ * Device privet data structure
+ *
+ * An open file keeps pointing at the instance after the device is unbound,
+ * so it is not devm managed: the device holds one reference from probe to
+ * remove, every open file holds one more, and the last put frees it.
+ */
 struct pcdev_private_data 
 {
+	struct kref ref;
 	struct pcdev_platform_data pdata;
 	char *buffer;
 	dev_t dev_num;
-	struct cdev cdev;
+	/* the buffer is zeroed in the background, open() waits for ready */
+	struct work_struct zero_work;
+	struct completion ready;
 };
 
-/* driver private data structure */
+/*
+ * driver private data structure
+ *
+ * One cdev covers the whole minor range, so adding a device never touches
+ * the char device map; open() finds the instance by minor in the xarray.
+ * Minors are handed out by the IDA and reused after a device goes away.
+ * Probes run in parallel, so the counters are atomic. load_start is taken
+ * at module init. Relative to it, probed_ns is the latest time a probe
+ * returned and ready_ns the latest time a device became usable.
+ */
 struct pcdrv_private_data
 {
-	int total_devices;
+	atomic_t total_devices;
 	dev_t device_num_base;
 	struct class *pcd_class;
-	struct device *pcd_device;
+	struct cdev cdev;
+	struct ida minor_ida;
+	struct xarray devices;
+	ktime_t load_start;
+	atomic64_t probed_ns;
+	atomic64_t ready_ns;
 };
 
 /*global instance for the driver private data */
 struct pcdrv_private_data pcdrv_data;
 
 
-ssize_t pcd_read (struct file * flip, char __user * buff, size_t count, loff_t * f_pos)
+static void pcd_dev_free(struct kref *ref)
 {
-	return 0;
+	struct pcdev_private_data *dev_data = container_of(ref, struct pcdev_private_data, ref);
+
+	kvfree(dev_data->buffer);
+	kfree(dev_data);
+}
+
+static void pcd_dev_put(struct pcdev_private_data *dev_data)
+{
+	kref_put(&dev_data->ref, pcd_dev_free);
+}
+
+/* check the open mode against the permission of the device */
+static int check_permission(int dev_perm, fmode_t f_mode)
+{
+	if(dev_perm == RDWR)
+		return 0;
+
+	/* read only access */
+	if(dev_perm == RDONLY && (f_mode & FMODE_READ) && !(f_mode & FMODE_WRITE))
+		return 0;
+
+	/* write only access */
+	if(dev_perm == WRONLY && (f_mode & FMODE_WRITE) && !(f_mode & FMODE_READ))
+		return 0;
+
+	return -EPERM;
+}
+
+ssize_t pcd_read (struct file * filp, char __user * buff, size_t count, loff_t * f_pos)
+{
+	struct pcdev_private_data *dev_data = filp->private_data;
+	int max_size = dev_data->pdata.size;
+
+	/* 1. adjust the count */
+	if(*f_pos >= max_size)
+		return 0;
+	if((*f_pos + count) > max_size)
+		count = max_size - *f_pos;
+
+	/* 2. copy_to_user */
+	if(copy_to_user(buff, dev_data->buffer + *f_pos, count))
+		return -EFAULT;
+
+	/* 3. update the f_pos w.r.t count */
+	*f_pos += count;
+	return count;
 }
 
 /* write operations from user space to kernel space */
 ssize_t pcd_write (struct file * filp, const char __user * buff, size_t count, loff_t * f_pos)
 {
-	pr_info("write file operations\r\n");
-	return -ENOMEM;
+	struct pcdev_private_data *dev_data = filp->private_data;
+	int max_size = dev_data->pdata.size;
+
+	/* 1. validate the count */
+	if(*f_pos >= max_size)
+		return -ENOMEM;
+	if((*f_pos + count) > max_size)
+		count = max_size - *f_pos;
+
+	if(!count)
+		return 0;
+
+	/* 2. copy_from_user */
+	if(copy_from_user(dev_data->buffer + *f_pos, buff, count))
+		return -EFAULT;
+
+	/* 3. update f_pos */
+	*f_pos += count;
+	return count;
 }
 
 
 /* open the device driver file */
-int pcd_open (struct inode * inode, struct file * flip)
+int pcd_open (struct inode * inode, struct file * filp)
 {
-	pr_info("open file operation called\r\n");
+	struct pcdev_private_data *dev_data;
+	int ret;
+
+	/*
+	 * 1. find the device that was opened by its minor and take a reference.
+	 * Under xa_lock remove() cannot erase the entry, and while the entry
+	 * is in the xarray the device's own reference keeps the instance alive.
+	 */
+	xa_lock(&pcdrv_data.devices);
+	dev_data = xa_load(&pcdrv_data.devices, inode->i_rdev - pcdrv_data.device_num_base);
+	if(dev_data)
+		kref_get(&dev_data->ref);
+	xa_unlock(&pcdrv_data.devices);
+	if(!dev_data)
+		return -ENODEV;
+
+	/* 2. the buffer may still be in the middle of its background zeroing */
+	if(wait_for_completion_killable(&dev_data->ready))
+	{
+		ret = -EINTR;
+		goto put_dev;
+	}
+
+	/* 3. check the access mode */
+	ret = check_permission(dev_data->pdata.perm, filp->f_mode);
+	if(ret)
+		goto put_dev;
+
+	/* 4. keep the device, and the reference, for the other file operations */
+	filp->private_data = dev_data;
+
 	return 0;
+
+put_dev:
+	pcd_dev_put(dev_data);
+	return ret;
 } 
 
-/* close the device file  */
-int pcd_release (struct inode * inode, struct file * flip)
+/* close the device file, the instance may outlive its device until here */
+int pcd_release (struct inode * inode, struct file * filp)
 {
-	pr_info("release operation called\r\n");
+	pcd_dev_put(filp->private_data);
 	return 0;
 }
 
 /* lseek the current file position pointer */
 loff_t pcd_llseek (struct file * filp, loff_t offset, int whence)
 {
-	pr_info("lseek operation called\r\n");
-	return 0;
+	struct pcdev_private_data *dev_data = filp->private_data;
+	int max_size = dev_data->pdata.size;
+	loff_t new_pos;
+
+	switch (whence)
+	{
+		case SEEK_SET:
+			new_pos = offset;
+			break;
+		case SEEK_CUR:
+			new_pos = filp->f_pos + offset;
+			break;
+		case SEEK_END:
+			new_pos = max_size + offset;
+			break;
+		default:
+			return -EINVAL;
+	}
 
+	if(new_pos < 0 || new_pos > max_size)
+		return -EINVAL;
+
+	filp->f_pos = new_pos;
+	return filp->f_pos;
 }
 
 /* uint32_t variable to hold the major(12 bit) + minor(20 bit) number */
@@ -82,19 +242,164 @@ struct file_operations pcd_fops =
 	.owner   = THIS_MODULE
 };
 
+/* move a load time stamp forward to now, probes and zeroing run in parallel */
+static void pcd_note_time(atomic64_t *stamp)
+{
+	s64 now = ktime_to_ns(ktime_sub(ktime_get(), pcdrv_data.load_start));
+	s64 old = atomic64_read(stamp);
+
+	while(old < now && !atomic64_try_cmpxchg(stamp, &old, now))
+		;
+}
+
+/* background zeroing of a freshly probed device buffer */
+static void pcd_zero_work(struct work_struct *work)
+{
+	struct pcdev_private_data *dev_data = container_of(work, struct pcdev_private_data, zero_work);
+
+	memset(dev_data->buffer, 0, dev_data->pdata.size);
+	complete_all(&dev_data->ready);
+	pcd_note_time(&pcdrv_data.ready_ns);
+}
+
 /* get called when the match platfrom device found */
 int pcd_platform_driver_prob(struct platform_device *pdev)
 {
-	pr_info("device is detected :)\r\n");
+	struct pcdev_private_data *dev_data;
+	struct pcdev_platform_data *pdata;
+	struct device *device;
+	int minor;
+	int ret;
+
+	/*1. get the platform data */
+	pdata = dev_get_platdata(&pdev->dev);
+	if(!pdata)
+	{
+		pr_err("no platform data available\r\n");
+		return -EINVAL;
+	}
+
+	if(pdata->size <= 0)
+	{
+		pr_err("invalid device size %d\r\n", pdata->size);
+		return -EINVAL;
+	}
+
+	/*
+	 * 2. allocate the device private data and the device buffer on the NUMA
+	 * node of the device. Not devm: open files may still use them after
+	 * remove(), the last pcd_dev_put() frees them. The buffer is not zeroed
+	 * here, pcd_zero_work() does that off the probe path.
+	 */
+	dev_data = kzalloc_node(sizeof(*dev_data), GFP_KERNEL, dev_to_node(&pdev->dev));
+	if(!dev_data)
+		return -ENOMEM;
+
+	kref_init(&dev_data->ref);
+	dev_data->pdata = *pdata;
+
+	dev_data->buffer = kvmalloc_node(dev_data->pdata.size, GFP_KERNEL, dev_to_node(&pdev->dev));
+	if(!dev_data->buffer)
+	{
+		ret = -ENOMEM;
+		goto put_dev;
+	}
+
+	INIT_WORK(&dev_data->zero_work, pcd_zero_work);
+	init_completion(&dev_data->ready);
+
+	dev_dbg(&pdev->dev, "serial number: %s size: %d perm: 0x%x node: %d\n",
+		dev_data->pdata.serial_number, dev_data->pdata.size,
+		dev_data->pdata.perm, dev_to_node(&pdev->dev));
+
+	/*3. allocate a free minor for this instance */
+	minor = ida_alloc_max(&pcdrv_data.minor_ida, max_devices - 1, GFP_KERNEL);
+	if(minor < 0)
+	{
+		pr_err("no free minor number\r\n");
+		ret = minor;
+		goto put_dev;
+	}
+	dev_data->dev_num = pcdrv_data.device_num_base + minor;
+
+	/*4. make the instance visible to open() */
+	ret = xa_err(xa_store(&pcdrv_data.devices, minor, dev_data, GFP_KERNEL));
+	if(ret < 0)
+		goto free_minor;
+
+	/*5. create the device file /dev/pcdev-<id> */
+	device = device_create(pcdrv_data.pcd_class, &pdev->dev, dev_data->dev_num,
+			       NULL, "pcdev-%d", pdev->id);
+	if(IS_ERR(device))
+	{
+		pr_err("device create failed\r\n");
+		ret = PTR_ERR(device);
+		goto erase_device;
+	}
+
+	/*6. save the private data for remove() */
+	platform_set_drvdata(pdev, dev_data);
+	atomic_inc(&pcdrv_data.total_devices);
+
+	/*7. zero the buffer in the background */
+	queue_work(system_unbound_wq, &dev_data->zero_work);
+	pcd_note_time(&pcdrv_data.probed_ns);
+
+	dev_dbg(&pdev->dev, "device is detected :)\n");
 	return 0;
+
+erase_device:
+	xa_erase(&pcdrv_data.devices, minor);
+free_minor:
+	ida_free(&pcdrv_data.minor_ida, minor);
+put_dev:
+	pcd_dev_put(dev_data);
+	return ret;
 }
 
 /* get called when the device remove from the system */
 void pcd_platform_driver_remove(struct platform_device *pdev)
 {
-	pr_info("device is removed :p \r\n");
+	struct pcdev_private_data *dev_data = platform_get_drvdata(pdev);
+	unsigned int minor = dev_data->dev_num - pcdrv_data.device_num_base;
+
+	/*1. hide the instance from open(), opens that found it hold their own reference */
+	xa_erase(&pcdrv_data.devices, minor);
+
+	/*2. remove the device file */
+	device_destroy(pcdrv_data.pcd_class, dev_data->dev_num);
+
+	/*3. the zeroing work must not outlive the device's reference */
+	flush_work(&dev_data->zero_work);
+
+	/*4. release the minor, open files keep their own reference to the instance */
+	ida_free(&pcdrv_data.minor_ida, minor);
+
+	atomic_dec(&pcdrv_data.total_devices);
+	dev_dbg(&pdev->dev, "device is removed :p\n");
+	pcd_dev_put(dev_data);
+}
+
+/* /sys/class/pcd_class/probe_time_us: module init until the last probe returned */
+static ssize_t probe_time_us_show(const struct class *class, const struct class_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%lld\n", div_s64(atomic64_read(&pcdrv_data.probed_ns), NSEC_PER_USEC));
+}
+static CLASS_ATTR_RO(probe_time_us);
+
+/* /sys/class/pcd_class/load_time_us: module init until the last device became usable */
+static ssize_t load_time_us_show(const struct class *class, const struct class_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%lld\n", div_s64(atomic64_read(&pcdrv_data.ready_ns), NSEC_PER_USEC));
+}
+static CLASS_ATTR_RO(load_time_us);
 
+/* /sys/class/pcd_class/total_devices: number of probed devices */
+static ssize_t total_devices_show(const struct class *class, const struct class_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%d\n", atomic_read(&pcdrv_data.total_devices));
 }
+static CLASS_ATTR_RO(total_devices);
 
 /* instance for the platfrom driver*/
 struct platform_driver pcd_platform_driver =
@@ -104,6 +409,8 @@ struct platform_driver pcd_platform_driver =
 	.driver = {
 		/*use the same, name used with the device for matching*/
 		.name = "pcd-char-device",
+		/* probe the devices in parallel, buffer allocation dominates probe time */
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 
@@ -113,29 +420,83 @@ static int __init pcd_platform_driver_init(void)
 {
 	int ret;
 	pr_info("platform driver init \r\n");
-	
-	/*1. Dynamically allocate the device number for MAX_DEVICES */
-	ret = alloc_chrdev_region(&pcdrv_data.device_num_base, 0, MAX_DEVICES, "pcdevs");
+
+	pcdrv_data.load_start = ktime_get();
+
+	if(!max_devices || max_devices > MINORMASK + 1)
+	{
+		pr_err("invalid max_devices %u\n", max_devices);
+		return -EINVAL;
+	}
+
+	ida_init(&pcdrv_data.minor_ida);
+	xa_init(&pcdrv_data.devices);
+
+	/*1. Dynamically allocate the device number for max_devices */
+	ret = alloc_chrdev_region(&pcdrv_data.device_num_base, 0, max_devices, "pcdevs");
 	if(ret <0){
 		pr_err("alloc chardev failed!");
 		return ret;
 	}
-	
-	/*2. create the class under /sys/class */
+
+	/*2. one cdev for the whole minor range */
+	cdev_init(&pcdrv_data.cdev, &pcd_fops);
+	pcdrv_data.cdev.owner = THIS_MODULE;
+	ret = cdev_add(&pcdrv_data.cdev, pcdrv_data.device_num_base, max_devices);
+	if(ret < 0)
+	{
+		pr_err("cdev add failed!\n");
+		goto unreg_chrdev;
+	}
+
+	/*3. create the class under /sys/class */
 	pcdrv_data.pcd_class  = class_create("pcd_class");
-        if(IS_ERR(pcdrv_data.pcd_class))
-        {
-                pr_err("class creation failed!\n");
-                ret = PTR_ERR(pcdrv_data.pcd_class);
-		unregister_chrdev_region(pcdrv_data.device_num_base, MAX_DEVICES);
-		return ret;
-        }
+	if(IS_ERR(pcdrv_data.pcd_class))
+	{
+		pr_err("class creation failed!\n");
+		ret = PTR_ERR(pcdrv_data.pcd_class);
+		goto cdev_del;
+	}
 
+	/* load time instrumentation, failure is not fatal */
+	if(class_create_file(pcdrv_data.pcd_class, &class_attr_probe_time_us) ||
+	   class_create_file(pcdrv_data.pcd_class, &class_attr_load_time_us) ||
+	   class_create_file(pcdrv_data.pcd_class, &class_attr_total_devices))
+		pr_warn("class attributes not created\n");
 
-	/*3. register the platform driver  */
-	platform_driver_register(&pcd_platform_driver);
-	pr_info("pcd_platform_driver loaded\r\n");
+	/*4. register the platform driver  */
+	if(sync_probe)
+		pcd_platform_driver.driver.probe_type = PROBE_FORCE_SYNCHRONOUS;
+
+	ret = platform_driver_register(&pcd_platform_driver);
+	if(ret < 0)
+	{
+		pr_err("platform driver register failed!\n");
+		goto class_destroy;
+	}
+	/*
+	 * with synchronous probing every probe has returned here. Asynchronous
+	 * probes are only queued: probe_time_us and load_time_us say when they
+	 * finished. insmod still waits for them in async_synchronize_full()
+	 * unless the module is loaded with async_probe=1, so only then does
+	 * insmod return before the probes are done.
+	 */
+	pr_info("pcd_platform_driver loaded, %s probe, register took %lld us (probes %s)\r\n",
+		sync_probe ? "synchronous" : "asynchronous",
+		ktime_us_delta(ktime_get(), pcdrv_data.load_start),
+		sync_probe ? "done" : "queued");
 	return 0;
+
+class_destroy:
+	class_remove_file(pcdrv_data.pcd_class, &class_attr_probe_time_us);
+	class_remove_file(pcdrv_data.pcd_class, &class_attr_load_time_us);
+	class_remove_file(pcdrv_data.pcd_class, &class_attr_total_devices);
+	class_destroy(pcdrv_data.pcd_class);
+cdev_del:
+	cdev_del(&pcdrv_data.cdev);
+unreg_chrdev:
+	unregister_chrdev_region(pcdrv_data.device_num_base, max_devices);
+	return ret;
 }
 /* Module exit section */
 static void __exit pcd_platform_driver_exit(void)
@@ -146,10 +507,17 @@ static void __exit pcd_platform_driver_exit(void)
 	platform_driver_unregister(&pcd_platform_driver);
 
 	/*2. class destroy*/
+	class_remove_file(pcdrv_data.pcd_class, &class_attr_probe_time_us);
+	class_remove_file(pcdrv_data.pcd_class, &class_attr_load_time_us);
+	class_remove_file(pcdrv_data.pcd_class, &class_attr_total_devices);
 	class_destroy(pcdrv_data.pcd_class);
 
-	/*3. Unregister the chrdev_region*/
-	unregister_chrdev_region(pcdrv_data.device_num_base, MAX_DEVICES);
+	/*3. remove the cdev and unregister the chrdev_region*/
+	cdev_del(&pcdrv_data.cdev);
+	unregister_chrdev_region(pcdrv_data.device_num_base, max_devices);
+
+	ida_destroy(&pcdrv_data.minor_ida);
+	xa_destroy(&pcdrv_data.devices);
 
 }
 
@@ -3,9 +3,12 @@
 #define RDONLY 0x01
 #define WRONLY 0x10
 
+/* room for the serial number string, including the terminating null */
+#define PCDEV_SERIAL_LEN  32
+
 struct pcdev_platform_data
 {
 	int size;
 	int perm;
-	const char *serial_number;
+	char serial_number[PCDEV_SERIAL_LEN];
 };
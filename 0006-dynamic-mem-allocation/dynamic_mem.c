@@ -2,27 +2,1358 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/slab.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mempool.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/vmstat.h>
+#include <linux/list.h>
+#include <linux/vmalloc.h>
+#include <linux/cache.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/cpumask.h>
+#include "kthread-bench.h"
 
 /* pointer to point the starting address of the allocated block of the memory*/
 void *ptr;
 
+/*
+ * slab cache benchmark
+ *
+ * A dedicated kmem_cache for a fixed-size object is compared with plain
+ * kmalloc() of the same size. nr_threads kthreads each run iterations rounds
+ * of "allocate batch objects, free them again", the per-op cost (one alloc +
+ * one free) and the bytes really used per object are reported through
+ * /sys/kernel/debug/dynamic_mem/slab_bench:
+ *   echo 1 > /sys/kernel/debug/dynamic_mem/slab_bench
+ *   cat /sys/kernel/debug/dynamic_mem/slab_bench
+ */
+unsigned int obj_size = 192;
+module_param(obj_size, uint, S_IRUGO);
+MODULE_PARM_DESC(obj_size, "benchmark object size in bytes (default 192)");
+
+unsigned int obj_align;
+module_param(obj_align, uint, S_IRUGO);
+MODULE_PARM_DESC(obj_align, "slab cache object alignment, power of 2 (default 0: none)");
+
+bool hwcache_align = true;
+module_param(hwcache_align, bool, S_IRUGO);
+MODULE_PARM_DESC(hwcache_align, "align the slab cache objects to the hardware cacheline (default Y)");
+
+unsigned int nr_threads;
+module_param(nr_threads, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(nr_threads, "benchmark threads (default 0: one per online cpu)");
+
+unsigned int iterations = 10000;
+module_param(iterations, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(iterations, "allocate/free rounds per thread (default 10000)");
+
+unsigned int batch = 32;
+module_param(batch, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(batch, "objects held at once per round (default 32)");
+
+/*
+ * atomic context allocation test
+ *
+ * A mempool of pool_min preallocated dm_obj objects backs allocations from a
+ * timer callback. Every tick allocates timer_allocs objects from the mempool
+ * and as many with kmalloc(GFP_ATOMIC), while the test holds memory: pages
+ * are grabbed until the free memory of the lowmem zones is down to their min
+ * watermark plus a quarter (or stress_mb is held, if that comes first).
+ * stress_all=1 ignores both and grabs pages until the page allocator gives
+ * up:
+ *   echo 1 > /sys/kernel/debug/dynamic_mem/mempool_bench
+ */
+unsigned int pool_min = 64;
+module_param(pool_min, uint, S_IRUGO);
+MODULE_PARM_DESC(pool_min, "objects preallocated in the mempool (default 64)");
+
+unsigned int timer_runs = 1000;
+module_param(timer_runs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(timer_runs, "timer callbacks per mempool test (default 1000)");
+
+unsigned int timer_allocs = 16;
+module_param(timer_allocs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(timer_allocs, "allocations per timer callback and allocator, at most pool_min (default 16)");
+
+unsigned int stress_mb;
+module_param(stress_mb, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(stress_mb, "most memory held during the mempool test in MB (default 0: down to the min watermark)");
+
+bool stress_all;
+module_param(stress_all, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(stress_all, "grab as much memory as possible during the mempool test, may OOM (default 0)");
+
+/* safety margin above the min watermark where the stress grab stops: min / 4 */
+#define DM_STRESS_MARGIN_SHIFT	2
+
+/*
+ * allocator sweep
+ *
+ * kmalloc, vmalloc, kvmalloc, alloc_pages and page_frag are timed for every
+ * power of two from 8 bytes up to sweep_max, results as CSV in
+ * /sys/kernel/debug/dynamic_mem/alloc_sweep.
+ */
+unsigned long sweep_max = 64UL << 20;
+module_param(sweep_max, ulong, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(sweep_max, "largest size of the allocator sweep in bytes (default 64MB)");
+
+unsigned int sweep_reps = 16;
+module_param(sweep_reps, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(sweep_reps, "allocations per allocator and size in the sweep (default 16)");
+
+unsigned int sweep_evict_mb = 64;
+module_param(sweep_evict_mb, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(sweep_evict_mb, "buffer read before the cold pass to evict caches and TLB, larger than the LLC (default 64MB)");
+
+#define DM_OBJ_MAGIC	0x6f626a21U
+#define DM_MAX_THREADS	1024U
+#define DM_MAX_BATCH	4096U
+
+/* header of every benchmark object, the rest of obj_size is payload */
+struct dm_obj
+{
+	u32 magic;
+	u32 allocs;
+};
+
+struct kmem_cache *dm_obj_cache;
+
+/* runs once per object when a new slab is populated, not on every allocation */
+static void dm_obj_ctor(void *p)
+{
+	struct dm_obj *obj = p;
+
+	obj->magic = DM_OBJ_MAGIC;
+	obj->allocs = 0;
+}
+
+/* the allocators under test */
+enum dm_alloc_kind
+{
+	DM_KMEM_CACHE,
+	DM_KMALLOC,
+	DM_MAGAZINE,
+	DM_NR_KINDS
+};
+
+const char *dm_kind_names[DM_NR_KINDS] = { "kmem_cache", "kmalloc", "magazine" };
+
+/*
+ * per-cpu magazine cache in front of dm_obj_cache
+ *
+ * Every cpu owns two magazines (stacks of up to DM_MAG_ROUNDS objects):
+ * "loaded" and "prev". Allocation pops from loaded and free pushes to it,
+ * with only preemption disabled: no lock, no atomic, no shared cacheline.
+ * When loaded runs empty (or full) it is swapped with prev; only when both
+ * are empty (or full) does the cpu go to the depot, under its spinlock, to
+ * trade a whole magazine. So at most one in DM_MAG_ROUNDS operations leaves
+ * the cpu, and a cpu that alternates alloc and free never does.
+ *
+ * Process context only: the magazines are not protected against interrupts.
+ */
+#define DM_MAG_ROUNDS	32
+
+struct dm_magazine
+{
+	struct dm_magazine *next;
+	unsigned int rounds;
+	void *objs[DM_MAG_ROUNDS];
+};
+
+struct dm_mag_cpu
+{
+	struct dm_magazine *loaded;
+	struct dm_magazine *prev;
+};
+
+DEFINE_PER_CPU(struct dm_mag_cpu, dm_mag_cpu);
+
+/* full and empty magazines shared by all cpus */
+struct dm_depot
+{
+	spinlock_t lock;
+	struct dm_magazine *full;
+	struct dm_magazine *empty;
+	unsigned long nr_full;
+	unsigned long nr_empty;
+};
+
+struct dm_depot dm_depot = { .lock = __SPIN_LOCK_UNLOCKED(dm_depot.lock) };
+
+static void *dm_mag_alloc(gfp_t gfp)
+{
+	struct dm_mag_cpu *c;
+	struct dm_magazine *full;
+	void *obj;
+
+	c = get_cpu_ptr(&dm_mag_cpu);
+
+	/* 1. hot path, the loaded magazine has objects */
+	if(c->loaded->rounds)
+		goto pop;
+
+	/* 2. the previous one still has some */
+	if(c->prev->rounds)
+	{
+		swap(c->loaded, c->prev);
+		goto pop;
+	}
+
+	/* 3. both empty: hand the empty prev to the depot for a full one */
+	spin_lock(&dm_depot.lock);
+	full = dm_depot.full;
+	if(full)
+	{
+		dm_depot.full = full->next;
+		dm_depot.nr_full--;
+		c->prev->next = dm_depot.empty;
+		dm_depot.empty = c->prev;
+		dm_depot.nr_empty++;
+		c->prev = c->loaded;
+		c->loaded = full;
+	}
+	spin_unlock(&dm_depot.lock);
+	if(full)
+		goto pop;
+	put_cpu_ptr(&dm_mag_cpu);
+
+	/* 4. depot is dry too, get a new object from the slab cache */
+	return kmem_cache_alloc(dm_obj_cache, gfp);
+
+pop:
+	obj = c->loaded->objs[--c->loaded->rounds];
+	put_cpu_ptr(&dm_mag_cpu);
+	return obj;
+}
+
+static void dm_mag_free(void *obj)
+{
+	struct dm_mag_cpu *c;
+	struct dm_magazine *empty;
+
+again:
+	c = get_cpu_ptr(&dm_mag_cpu);
+
+	/* 1. hot path, room in the loaded magazine */
+	if(c->loaded->rounds < DM_MAG_ROUNDS)
+		goto push;
+
+	/* 2. room in the previous one */
+	if(c->prev->rounds < DM_MAG_ROUNDS)
+	{
+		swap(c->loaded, c->prev);
+		goto push;
+	}
+
+	/* 3. both full: hand the full prev to the depot for an empty one */
+	spin_lock(&dm_depot.lock);
+	empty = dm_depot.empty;
+	if(empty)
+	{
+		dm_depot.empty = empty->next;
+		dm_depot.nr_empty--;
+		c->prev->next = dm_depot.full;
+		dm_depot.full = c->prev;
+		dm_depot.nr_full++;
+		c->prev = c->loaded;
+		c->loaded = empty;
+	}
+	spin_unlock(&dm_depot.lock);
+	if(empty)
+		goto push;
+	put_cpu_ptr(&dm_mag_cpu);
+
+	/* 4. no empty magazine anywhere, make one and retry, or give the object back to the slab */
+	empty = kzalloc(sizeof(*empty), GFP_NOWAIT | __GFP_NOWARN);
+	if(!empty)
+	{
+		kmem_cache_free(dm_obj_cache, obj);
+		return;
+	}
+	spin_lock(&dm_depot.lock);
+	empty->next = dm_depot.empty;
+	dm_depot.empty = empty;
+	dm_depot.nr_empty++;
+	spin_unlock(&dm_depot.lock);
+	goto again;
+
+push:
+	c->loaded->objs[c->loaded->rounds++] = obj;
+	put_cpu_ptr(&dm_mag_cpu);
+}
+
+/* return the objects of a magazine to the slab cache and free the magazine */
+static void dm_mag_drain(struct dm_magazine *mag)
+{
+	while(mag->rounds)
+		kmem_cache_free(dm_obj_cache, mag->objs[--mag->rounds]);
+	kfree(mag);
+}
+
+static void dm_mag_destroy(void)
+{
+	struct dm_magazine *mag;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		struct dm_mag_cpu *c = per_cpu_ptr(&dm_mag_cpu, cpu);
+
+		if(c->loaded)
+			dm_mag_drain(c->loaded);
+		if(c->prev)
+			dm_mag_drain(c->prev);
+		c->loaded = c->prev = NULL;
+	}
+	while((mag = dm_depot.full))
+	{
+		dm_depot.full = mag->next;
+		dm_mag_drain(mag);
+	}
+	while((mag = dm_depot.empty))
+	{
+		dm_depot.empty = mag->next;
+		dm_mag_drain(mag);
+	}
+	dm_depot.nr_full = dm_depot.nr_empty = 0;
+}
+
+/* every cpu starts with two empty magazines */
+static int dm_mag_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		struct dm_mag_cpu *c = per_cpu_ptr(&dm_mag_cpu, cpu);
+
+		c->loaded = kzalloc_node(sizeof(*c->loaded), GFP_KERNEL, cpu_to_node(cpu));
+		c->prev = kzalloc_node(sizeof(*c->prev), GFP_KERNEL, cpu_to_node(cpu));
+		if(!c->loaded || !c->prev)
+		{
+			dm_mag_destroy();
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/* allocate one object, both paths hand back an initialized header */
+static struct dm_obj *dm_obj_alloc(enum dm_alloc_kind kind)
+{
+	struct dm_obj *obj;
+
+	if(kind == DM_KMEM_CACHE || kind == DM_MAGAZINE)
+	{
+		/* the constructor already set up the header */
+		if(kind == DM_KMEM_CACHE)
+			obj = kmem_cache_alloc(dm_obj_cache, GFP_KERNEL);
+		else
+			obj = dm_mag_alloc(GFP_KERNEL);
+		if(obj)
+			obj->allocs++;
+		return obj;
+	}
+
+	obj = kmalloc(obj_size, GFP_KERNEL);
+	if(obj)
+	{
+		obj->magic = DM_OBJ_MAGIC;
+		obj->allocs = 1;
+	}
+	return obj;
+}
+
+static void dm_obj_free(enum dm_alloc_kind kind, struct dm_obj *obj)
+{
+	if(kind == DM_KMEM_CACHE)
+		kmem_cache_free(dm_obj_cache, obj);
+	else if(kind == DM_MAGAZINE)
+		dm_mag_free(obj);
+	else
+		kfree(obj);
+}
+
+/*
+ * benchmark threads
+ *
+ * All threads are created first and block on "start", so they hit the
+ * allocator at the same time. The last one to finish completes "done"; the
+ * runner then reaps every thread with kthread_stop().
+ */
+struct dm_bench_run;
+
+struct dm_bench_thread
+{
+	struct task_struct *task;
+	struct dm_bench_run *run;
+	unsigned int idx;
+	u64 ns;
+	u64 ops;
+	u64 failures;
+};
+
+struct dm_bench_run
+{
+	int (*fn)(struct dm_bench_thread *t);
+	void *arg;
+	unsigned int iterations;
+	unsigned int batch;
+	struct completion start;
+	struct completion done;
+	atomic_t remaining;
+	unsigned int nr;
+	struct dm_bench_thread *threads;
+};
+
+static int dm_bench_thread_fn(void *data)
+{
+	struct dm_bench_thread *t = data;
+	struct dm_bench_run *run = t->run;
+
+	wait_for_completion(&run->start);
+	run->fn(t);
+	if(atomic_dec_and_test(&run->remaining))
+		complete(&run->done);
+	return 0;
+}
+
+/* run fn on nr threads, bind thread i to the i-th online cpu when bind is set */
+static int dm_run_threads(struct dm_bench_run *run, unsigned int nr, bool bind)
+{
+	unsigned int i;
+	int ret = 0;
+
+	run->nr = nr;
+	run->threads = kcalloc(nr, sizeof(*run->threads), GFP_KERNEL);
+	if(!run->threads)
+		return -ENOMEM;
+	init_completion(&run->start);
+	init_completion(&run->done);
+	atomic_set(&run->remaining, nr);
+
+	/* 1. create the threads, they wait for the start signal */
+	for(i = 0; i < nr; i++)
+	{
+		struct dm_bench_thread *t = &run->threads[i];
+
+		t->run = run;
+		t->idx = i;
+		t->task = kthread_create(dm_bench_thread_fn, t, "dm_bench/%u", i);
+		if(IS_ERR(t->task))
+		{
+			ret = PTR_ERR(t->task);
+			t->task = NULL;
+			break;
+		}
+		if(bind)
+			kthread_bind(t->task, cpumask_nth(i % num_online_cpus(), cpu_online_mask));
+		/* keep the task around for kthread_stop() even after it exits */
+		get_task_struct(t->task);
+		wake_up_process(t->task);
+	}
+
+	/* 2. threads that were not created count as finished */
+	if(ret && atomic_sub_and_test(nr - i, &run->remaining))
+		complete(&run->done);
+
+	/* 3. go, and wait until every thread is through its loop */
+	complete_all(&run->start);
+	wait_for_completion(&run->done);
+
+	/* 4. reap the threads */
+	for(i = 0; i < nr; i++)
+	{
+		if(!run->threads[i].task)
+			continue;
+		kthread_stop(run->threads[i].task);
+		put_task_struct(run->threads[i].task);
+	}
+	return ret;
+}
+
+static void dm_free_run(struct dm_bench_run *run)
+{
+	kfree(run->threads);
+	run->threads = NULL;
+}
+
+/* average cost of one op per thread, in ns */
+static u64 dm_run_ns_per_op(struct dm_bench_run *run)
+{
+	u64 ns = 0, ops = 0;
+	unsigned int i;
+
+	for(i = 0; i < run->nr; i++)
+	{
+		ns += run->threads[i].ns;
+		ops += run->threads[i].ops;
+	}
+	return ops ? div64_u64(ns, ops) : 0;
+}
+
+static u64 dm_run_failures(struct dm_bench_run *run)
+{
+	u64 failures = 0;
+	unsigned int i;
+
+	for(i = 0; i < run->nr; i++)
+		failures += run->threads[i].failures;
+	return failures;
+}
+
+/* results of the last slab benchmark run */
+struct dm_slab_result
+{
+	u64 ns_per_op;
+	u64 failures;
+	unsigned int obj_bytes;
+};
+
+struct dm_slab_bench
+{
+	bool valid;
+	unsigned int threads;
+	unsigned int iterations;
+	unsigned int batch;
+	struct dm_slab_result res[DM_NR_KINDS];
+};
+
+struct dm_slab_bench slab_bench;
+
+/* one slab benchmark thread: iterations x (alloc batch, free batch) */
+static int dm_slab_bench_fn(struct dm_bench_thread *t)
+{
+	enum dm_alloc_kind kind = (uintptr_t)t->run->arg;
+	struct dm_obj **objs;
+	unsigned int i, j, n;
+	unsigned int nr = t->run->batch;
+	ktime_t start;
+
+	objs = kmalloc_array(nr, sizeof(*objs), GFP_KERNEL);
+	if(!objs)
+	{
+		t->failures++;
+		return -ENOMEM;
+	}
+
+	start = ktime_get();
+	for(i = 0; i < t->run->iterations; i++)
+	{
+		for(n = 0; n < nr; n++)
+		{
+			objs[n] = dm_obj_alloc(kind);
+			if(!objs[n])
+			{
+				t->failures++;
+				break;
+			}
+		}
+		for(j = 0; j < n; j++)
+		{
+			WARN_ON_ONCE(objs[j]->magic != DM_OBJ_MAGIC);
+			dm_obj_free(kind, objs[j]);
+		}
+		t->ops += n;
+		cond_resched();
+	}
+	t->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	kfree(objs);
+	return 0;
+}
+
+/* benchmarks are serialized, they share the module parameters and results */
+DEFINE_MUTEX(dm_bench_lock);
+
+static int dm_slab_bench_run(void)
+{
+	struct dm_bench_run run = { .fn = dm_slab_bench_fn };
+	unsigned int threads = nr_threads ? nr_threads : num_online_cpus();
+	void *probe;
+	int kind;
+	int ret;
+
+	/* snapshot the parameters, they can be changed while the threads run */
+	slab_bench.valid = false;
+	slab_bench.threads = threads;
+	slab_bench.iterations = iterations;
+	slab_bench.batch = batch;
+	if(threads > DM_MAX_THREADS || !slab_bench.batch || slab_bench.batch > DM_MAX_BATCH)
+		return -EINVAL;
+
+	run.iterations = slab_bench.iterations;
+	run.batch = slab_bench.batch;
+
+	/*
+	 * 1. memory really used per object: the aligned slot of a cache object
+	 * vs the kmalloc bucket. kmem_cache_size() is only the requested
+	 * object size, so measure both the same way, with ksize().
+	 */
+	probe = kmem_cache_alloc(dm_obj_cache, GFP_KERNEL);
+	if(!probe)
+		return -ENOMEM;
+	slab_bench.res[DM_KMEM_CACHE].obj_bytes = ksize(probe);
+	slab_bench.res[DM_MAGAZINE].obj_bytes = ksize(probe);
+	kmem_cache_free(dm_obj_cache, probe);
+
+	probe = kmalloc(obj_size, GFP_KERNEL);
+	if(!probe)
+		return -ENOMEM;
+	slab_bench.res[DM_KMALLOC].obj_bytes = ksize(probe);
+	kfree(probe);
+
+	/* 2. time the allocators */
+	for(kind = 0; kind < DM_NR_KINDS; kind++)
+	{
+		run.arg = (void *)(uintptr_t)kind;
+		ret = dm_run_threads(&run, threads, false);
+		if(!ret)
+		{
+			slab_bench.res[kind].ns_per_op = dm_run_ns_per_op(&run);
+			slab_bench.res[kind].failures = dm_run_failures(&run);
+		}
+		dm_free_run(&run);
+		if(ret)
+			return ret;
+	}
+
+	slab_bench.valid = true;
+	return 0;
+}
+
+static void dm_slab_bench_show(struct seq_file *s)
+{
+	int kind;
+
+	if(!slab_bench.valid)
+	{
+		seq_puts(s, "no results, write 1 to run the benchmark\n");
+		return;
+	}
+	seq_printf(s, "obj_size %u align %u hwcache_align %d threads %u iterations %u batch %u\n",
+		   obj_size, obj_align, hwcache_align, slab_bench.threads,
+		   slab_bench.iterations, slab_bench.batch);
+	seq_printf(s, "%-12s %10s %12s %10s %10s\n", "allocator", "obj_bytes", "overhead_pct",
+		   "ns_per_op", "failures");
+	for(kind = 0; kind < DM_NR_KINDS; kind++)
+	{
+		struct dm_slab_result *r = &slab_bench.res[kind];
+
+		seq_printf(s, "%-12s %10u %12u %10llu %10llu\n", dm_kind_names[kind], r->obj_bytes,
+			   (r->obj_bytes - obj_size) * 100 / obj_size, r->ns_per_op, r->failures);
+	}
+}
+
+/*
+ * magazine scaling benchmark
+ *
+ * The slab benchmark loop runs on 1, 2, 4, ... threads up to one per online
+ * cpu, each thread bound to its own cpu, for kmalloc, the bare kmem_cache and
+ * the magazine layer. With per-cpu magazines ns_per_op should stay flat as
+ * threads are added, throughput (kops_s, all threads together) should grow
+ * linearly.
+ */
+#define DM_SCALE_MAX_STEPS	16
+
+struct dm_scale_result
+{
+	unsigned int threads;
+	u64 ns_per_op[DM_NR_KINDS];
+	u64 kops_s[DM_NR_KINDS];
+};
+
+struct dm_scale_bench
+{
+	bool valid;
+	unsigned int iterations;
+	unsigned int batch;
+	unsigned int nr_steps;
+	struct dm_scale_result res[DM_SCALE_MAX_STEPS];
+};
+
+struct dm_scale_bench scale_bench;
+
+/* all threads together, in thousand ops per second, over the slowest thread's time */
+static u64 dm_run_kops_s(struct dm_bench_run *run)
+{
+	u64 ops = 0, ns = 0;
+	unsigned int i;
+
+	for(i = 0; i < run->nr; i++)
+	{
+		ops += run->threads[i].ops;
+		ns = max(ns, run->threads[i].ns);
+	}
+	return ns ? div64_u64(ops * USEC_PER_SEC, ns) : 0;
+}
+
+static int dm_scale_bench_run(void)
+{
+	struct dm_scale_bench *b = &scale_bench;
+	struct dm_bench_run run = { .fn = dm_slab_bench_fn };
+	unsigned int cpus = num_online_cpus();
+	unsigned int threads, n;
+	int kind;
+	int ret;
+
+	b->valid = false;
+	b->iterations = iterations;
+	b->batch = batch;
+	if(!b->batch || b->batch > DM_MAX_BATCH)
+		return -EINVAL;
+	run.iterations = b->iterations;
+	run.batch = b->batch;
+
+	/* 1, 2, 4, ... and always the full set of online cpus as the last step */
+	for(n = 0, threads = 1; n < DM_SCALE_MAX_STEPS; n++)
+	{
+		b->res[n].threads = threads;
+		for(kind = 0; kind < DM_NR_KINDS; kind++)
+		{
+			run.arg = (void *)(uintptr_t)kind;
+			ret = dm_run_threads(&run, threads, true);
+			if(!ret)
+			{
+				b->res[n].ns_per_op[kind] = dm_run_ns_per_op(&run);
+				b->res[n].kops_s[kind] = dm_run_kops_s(&run);
+			}
+			dm_free_run(&run);
+			if(ret)
+				return ret;
+		}
+		if(threads == cpus)
+			break;
+		threads = min(threads * 2, cpus);
+	}
+
+	b->nr_steps = min_t(unsigned int, n + 1, DM_SCALE_MAX_STEPS);
+	b->valid = true;
+	return 0;
+}
+
+static void dm_scale_bench_show(struct seq_file *s)
+{
+	struct dm_scale_bench *b = &scale_bench;
+	unsigned int n;
+	int kind;
+
+	if(!b->valid)
+	{
+		seq_puts(s, "no results, write 1 to run the benchmark\n");
+		return;
+	}
+	seq_printf(s, "obj_size %u iterations %u batch %u magazine_rounds %u\n",
+		   obj_size, b->iterations, b->batch, DM_MAG_ROUNDS);
+	seq_printf(s, "%-8s", "threads");
+	for(kind = 0; kind < DM_NR_KINDS; kind++)
+		seq_printf(s, " %10s_ns %10s_kops", dm_kind_names[kind], dm_kind_names[kind]);
+	seq_putc(s, '\n');
+	for(n = 0; n < b->nr_steps; n++)
+	{
+		seq_printf(s, "%-8u", b->res[n].threads);
+		for(kind = 0; kind < DM_NR_KINDS; kind++)
+			seq_printf(s, " %13llu %15llu", b->res[n].ns_per_op[kind], b->res[n].kops_s[kind]);
+		seq_putc(s, '\n');
+	}
+}
+
+/*
+ * atomic context allocation test
+ *
+ * The timer callback runs in softirq context: it can neither sleep nor
+ * reclaim, so a plain GFP_ATOMIC allocation fails once the atomic reserves
+ * are gone. mempool_alloc() first tries the slab cache and then falls back
+ * to the preallocated elements, so as long as at most pool_min objects are
+ * in flight it cannot fail.
+ */
+mempool_t *dm_pool;
+
+enum dm_atomic_kind
+{
+	DM_ATOMIC_MEMPOOL,
+	DM_ATOMIC_KMALLOC,
+	DM_NR_ATOMIC_KINDS
+};
+
+const char *dm_atomic_names[DM_NR_ATOMIC_KINDS] = { "mempool", "kmalloc_atomic" };
+
+struct dm_atomic_result
+{
+	u64 allocs;
+	u64 failures;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+struct dm_atomic_bench
+{
+	bool valid;
+	unsigned int runs;
+	unsigned int allocs;
+	unsigned long stress_mb;
+	/* free pages and min watermark of the lowmem zones once the memory was grabbed */
+	unsigned long free_pages;
+	unsigned long min_pages;
+	bool pressure;
+	struct timer_list timer;
+	unsigned int ticks;
+	struct completion done;
+	/* objects held during one callback */
+	void **held[DM_NR_ATOMIC_KINDS];
+	struct dm_atomic_result res[DM_NR_ATOMIC_KINDS];
+};
+
+struct dm_atomic_bench atomic_bench;
+
+static void dm_atomic_account(struct dm_atomic_result *r, void *obj, u64 ns)
+{
+	r->allocs++;
+	r->total_ns += ns;
+	if(ns > r->max_ns)
+		r->max_ns = ns;
+	if(!obj)
+		r->failures++;
+}
+
+static void dm_atomic_timer_fn(struct timer_list *t)
+{
+	struct dm_atomic_bench *b = from_timer(b, t, timer);
+	unsigned int i;
+	u64 start;
+
+	/* 1. allocate from both sources, holding everything until the end of the tick */
+	for(i = 0; i < b->allocs; i++)
+	{
+		start = ktime_get_ns();
+		b->held[DM_ATOMIC_MEMPOOL][i] = mempool_alloc(dm_pool, GFP_ATOMIC);
+		dm_atomic_account(&b->res[DM_ATOMIC_MEMPOOL], b->held[DM_ATOMIC_MEMPOOL][i],
+				  ktime_get_ns() - start);
+
+		start = ktime_get_ns();
+		b->held[DM_ATOMIC_KMALLOC][i] = kmalloc(obj_size, GFP_ATOMIC | __GFP_NOWARN);
+		dm_atomic_account(&b->res[DM_ATOMIC_KMALLOC], b->held[DM_ATOMIC_KMALLOC][i],
+				  ktime_get_ns() - start);
+	}
+
+	/* 2. give everything back, refilling the mempool reserve */
+	for(i = 0; i < b->allocs; i++)
+	{
+		if(b->held[DM_ATOMIC_MEMPOOL][i])
+			mempool_free(b->held[DM_ATOMIC_MEMPOOL][i], dm_pool);
+		kfree(b->held[DM_ATOMIC_KMALLOC][i]);
+	}
+
+	/* 3. re-arm for the next jiffy */
+	if(++b->ticks < b->runs)
+		mod_timer(&b->timer, jiffies + 1);
+	else
+		complete(&b->done);
+}
+
+/* free pages and min watermark of the zones a GFP_KERNEL allocation can use */
+static void dm_lowmem_state(unsigned long *free, unsigned long *min)
+{
+	struct zone *zone;
+	int nid, i;
+
+	*free = 0;
+	*min = 0;
+	for_each_online_node(nid)
+	{
+		for(i = 0; i <= ZONE_NORMAL; i++)
+		{
+			zone = &NODE_DATA(nid)->node_zones[i];
+			if(!populated_zone(zone))
+				continue;
+			*free += zone_page_state(zone, NR_FREE_PAGES);
+			*min += min_wmark_pages(zone);
+		}
+	}
+}
+
+/*
+ * hold memory until the lowmem zones are down to their min watermark plus a
+ * margin, where atomic allocations start to compete for the reserves, or
+ * until mb is held. With all set, hold as much as the page allocator gives
+ * without retrying.
+ */
+static unsigned long dm_stress_grab(struct list_head *pages, unsigned long mb, bool all)
+{
+	unsigned long nr = 0, max, free, min;
+	struct page *page;
+
+	max = mb && !all ? mb << (20 - PAGE_SHIFT) : ULONG_MAX;
+
+	while(nr < max)
+	{
+		if(!all)
+		{
+			dm_lowmem_state(&free, &min);
+			if(free <= min + (min >> DM_STRESS_MARGIN_SHIFT))
+				break;
+		}
+		page = alloc_page(GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN);
+		if(!page)
+			break;
+		list_add(&page->lru, pages);
+		nr++;
+		if(!(nr % 1024))
+			cond_resched();
+	}
+	return nr;
+}
+
+static void dm_stress_release(struct list_head *pages)
+{
+	struct page *page, *tmp;
+
+	list_for_each_entry_safe(page, tmp, pages, lru)
+	{
+		list_del(&page->lru);
+		__free_page(page);
+	}
+}
+
+static int dm_atomic_bench_run(void)
+{
+	struct dm_atomic_bench *b = &atomic_bench;
+	LIST_HEAD(stress_pages);
+	unsigned long nr_pages;
+	int kind;
+	int ret = 0;
+
+	/* snapshot the parameters, the pool guarantee only holds for allocs <= pool_min */
+	b->valid = false;
+	b->runs = timer_runs;
+	b->allocs = timer_allocs;
+	if(!b->runs || !b->allocs || b->allocs > pool_min)
+		return -EINVAL;
+
+	memset(b->res, 0, sizeof(b->res));
+	for(kind = 0; kind < DM_NR_ATOMIC_KINDS; kind++)
+	{
+		b->held[kind] = kcalloc(b->allocs, sizeof(void *), GFP_KERNEL);
+		if(!b->held[kind])
+		{
+			ret = -ENOMEM;
+			goto free_held;
+		}
+	}
+
+	/* 1. put the system under memory pressure */
+	nr_pages = dm_stress_grab(&stress_pages, stress_mb, stress_all);
+	b->stress_mb = nr_pages >> (20 - PAGE_SHIFT);
+	dm_lowmem_state(&b->free_pages, &b->min_pages);
+	b->pressure = b->free_pages <= b->min_pages + (b->min_pages >> DM_STRESS_MARGIN_SHIFT);
+	if(!b->pressure)
+		pr_warn("mempool test: free memory stayed above the min watermark (%lu > %lu pages), results show no pressure\r\n",
+			b->free_pages, b->min_pages);
+
+	/* 2. run the timer until it has ticked b->runs times */
+	b->ticks = 0;
+	init_completion(&b->done);
+	timer_setup(&b->timer, dm_atomic_timer_fn, 0);
+	mod_timer(&b->timer, jiffies + 1);
+	wait_for_completion(&b->done);
+	del_timer_sync(&b->timer);
+
+	/* 3. release the pressure */
+	dm_stress_release(&stress_pages);
+	b->valid = true;
+
+free_held:
+	for(kind = 0; kind < DM_NR_ATOMIC_KINDS; kind++)
+	{
+		kfree(b->held[kind]);
+		b->held[kind] = NULL;
+	}
+	return ret;
+}
+
+static void dm_atomic_bench_show(struct seq_file *s)
+{
+	struct dm_atomic_bench *b = &atomic_bench;
+	int kind;
+
+	if(!b->valid)
+	{
+		seq_puts(s, "no results, write 1 to run the test\n");
+		return;
+	}
+	seq_printf(s, "obj_size %u pool_min %u timer_runs %u timer_allocs %u stress_mb %lu\n",
+		   obj_size, pool_min, b->runs, b->allocs, b->stress_mb);
+	seq_printf(s, "free_pages %lu min_wmark_pages %lu\n", b->free_pages, b->min_pages);
+	if(!b->pressure)
+		seq_puts(s, "warning: the min watermark was not reached, this run was not under memory pressure\n");
+	seq_printf(s, "%-16s %10s %10s %10s %10s\n", "allocator", "allocs", "failures",
+		   "avg_ns", "max_ns");
+	for(kind = 0; kind < DM_NR_ATOMIC_KINDS; kind++)
+	{
+		struct dm_atomic_result *r = &b->res[kind];
+
+		seq_printf(s, "%-16s %10llu %10llu %10llu %10llu\n", dm_atomic_names[kind],
+			   r->allocs, r->failures, r->allocs ? div64_u64(r->total_ns, r->allocs) : 0,
+			   r->max_ns);
+	}
+}
+
+/*
+ * allocator sweep
+ *
+ * For every allocator and size, each repetition measures:
+ *   alloc_ns - the allocation call
+ *   touch_ns - the first write of every cacheline, i.e. first-touch cost
+ *   scan_ns  - a second, read-only pass right after the touch, one load per
+ *              cacheline. Buffers that fit in the caches are read hot, so
+ *              this is cache read cost; larger ones fall out to memory
+ *              bandwidth. TLB misses are included but not isolated.
+ *   cold_ns  - per page: after reading sweep_evict_mb of vmalloc memory
+ *              (4K ptes, so it flushes the TLB as well as the caches), one
+ *              load per PAGE_SIZE. Every load misses the caches for every
+ *              allocator; what differs is the page walk. The linear map
+ *              (kmalloc, alloc_pages) is covered by a few huge page TLB
+ *              entries, vmalloc needs one per 4K page, so its cold_ns steps
+ *              up once the buffer exceeds the TLB reach.
+ *   free_ns  - the free call
+ */
+#define DM_SWEEP_MIN		8UL
+#define DM_SWEEP_MAX_SIZES	40
+
+static void *dm_kmalloc_alloc(size_t size)
+{
+	return kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+}
+
+static void dm_kmalloc_free(void *p, size_t size)
+{
+	kfree(p);
+}
+
+static void *dm_vmalloc_alloc(size_t size)
+{
+	return vmalloc(size);
+}
+
+static void dm_vmalloc_free(void *p, size_t size)
+{
+	vfree(p);
+}
+
+static void *dm_kvmalloc_alloc(size_t size)
+{
+	return kvmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+}
+
+static void dm_kvmalloc_free(void *p, size_t size)
+{
+	kvfree(p);
+}
+
+static void *dm_pages_alloc(size_t size)
+{
+	struct page *page = alloc_pages(GFP_KERNEL | __GFP_NOWARN, get_order(size));
+
+	return page ? page_address(page) : NULL;
+}
+
+static void dm_pages_free(void *p, size_t size)
+{
+	__free_pages(virt_to_page(p), get_order(size));
+}
+
+/* fragments are carved out of a cached page, the page goes when all fragments are freed */
+struct page_frag_cache dm_frag_cache;
+
+static void *dm_frag_alloc(size_t size)
+{
+	return page_frag_alloc(&dm_frag_cache, size, GFP_KERNEL | __GFP_NOWARN);
+}
+
+static void dm_frag_free(void *p, size_t size)
+{
+	page_frag_free(p);
+}
+
+struct dm_allocator
+{
+	const char *name;
+	unsigned long max;
+	void *(*alloc)(size_t size);
+	void (*free)(void *p, size_t size);
+};
+
+const struct dm_allocator dm_allocators[] =
+{
+	{ "kmalloc",     KMALLOC_MAX_SIZE,               dm_kmalloc_alloc,  dm_kmalloc_free },
+	{ "vmalloc",     ULONG_MAX,                      dm_vmalloc_alloc,  dm_vmalloc_free },
+	{ "kvmalloc",    ULONG_MAX,                      dm_kvmalloc_alloc, dm_kvmalloc_free },
+	{ "alloc_pages", PAGE_SIZE << MAX_PAGE_ORDER,    dm_pages_alloc,    dm_pages_free },
+	{ "page_frag",   PAGE_SIZE,                      dm_frag_alloc,     dm_frag_free },
+};
+
+#define DM_NR_ALLOCATORS ARRAY_SIZE(dm_allocators)
+
+struct dm_sweep_result
+{
+	unsigned long size;
+	unsigned int reps;
+	unsigned int failures;
+	u64 alloc_ns;
+	u64 free_ns;
+	u64 touch_ns;
+	u64 scan_ns;
+	u64 cold_ns;
+	u64 cold_pages;
+};
+
+struct dm_sweep_bench
+{
+	bool valid;
+	unsigned int nr_sizes;
+	struct dm_sweep_result res[DM_NR_ALLOCATORS][DM_SWEEP_MAX_SIZES];
+};
+
+struct dm_sweep_bench sweep_bench;
+
+/* keeps the compiler from dropping the read-only scans */
+unsigned long dm_scan_sink;
+
+/* read every cacheline of the eviction buffer, pushing p out of the caches and TLB */
+static unsigned long dm_sweep_evict(const u8 *evict, unsigned long evict_size)
+{
+	unsigned long off, sum = 0;
+
+	for(off = 0; off < evict_size; off += L1_CACHE_BYTES)
+		sum += READ_ONCE(evict[off]);
+	return sum;
+}
+
+static void dm_sweep_one(const struct dm_allocator *a, struct dm_sweep_result *r,
+			 unsigned long size, unsigned int reps,
+			 const u8 *evict, unsigned long evict_size)
+{
+	unsigned long off, sum = 0;
+	unsigned int i;
+	u8 *p;
+	u64 t0, t1;
+
+	r->size = size;
+	r->reps = reps;
+	for(i = 0; i < reps; i++)
+	{
+		/* 1. allocation */
+		t0 = ktime_get_ns();
+		p = a->alloc(size);
+		t1 = ktime_get_ns();
+		if(!p)
+		{
+			r->failures++;
+			continue;
+		}
+		r->alloc_ns += t1 - t0;
+
+		/* 2. first touch, one write per cacheline */
+		t0 = ktime_get_ns();
+		for(off = 0; off < size; off += L1_CACHE_BYTES)
+			WRITE_ONCE(p[off], (u8)off);
+		t1 = ktime_get_ns();
+		r->touch_ns += t1 - t0;
+
+		/* 3. sequential read scan, hot for buffers that fit in the caches */
+		t0 = ktime_get_ns();
+		for(off = 0; off < size; off += L1_CACHE_BYTES)
+			sum += READ_ONCE(p[off]);
+		t1 = ktime_get_ns();
+		r->scan_ns += t1 - t0;
+
+		/* 4. cold pass, one load per page after evicting caches and TLB */
+		if(size >= PAGE_SIZE)
+		{
+			sum += dm_sweep_evict(evict, evict_size);
+			t0 = ktime_get_ns();
+			for(off = 0; off < size; off += PAGE_SIZE)
+				sum += READ_ONCE(p[off]);
+			t1 = ktime_get_ns();
+			r->cold_ns += t1 - t0;
+			r->cold_pages += size >> PAGE_SHIFT;
+		}
+
+		/* 5. free */
+		t0 = ktime_get_ns();
+		a->free(p, size);
+		t1 = ktime_get_ns();
+		r->free_ns += t1 - t0;
+
+		cond_resched();
+	}
+	dm_scan_sink = sum;
+}
+
+static int dm_sweep_bench_run(void)
+{
+	struct dm_sweep_bench *b = &sweep_bench;
+	unsigned long max = sweep_max;
+	unsigned int reps = sweep_reps;
+	unsigned long evict_size = (unsigned long)sweep_evict_mb << 20;
+	unsigned long size;
+	unsigned int i, n;
+	u8 *evict;
+
+	if(!reps || max < DM_SWEEP_MIN || !evict_size)
+		return -EINVAL;
+
+	/* 4K mapped, so walking it evicts TLB entries too, not only cachelines */
+	evict = vzalloc(evict_size);
+	if(!evict)
+		return -ENOMEM;
+
+	b->valid = false;
+	memset(b->res, 0, sizeof(b->res));
+
+	for(n = 0, size = DM_SWEEP_MIN; size <= max && n < DM_SWEEP_MAX_SIZES; size <<= 1, n++)
+	{
+		for(i = 0; i < DM_NR_ALLOCATORS; i++)
+		{
+			/* sizes the allocator cannot serve are left out of the output */
+			if(size > dm_allocators[i].max)
+				continue;
+			dm_sweep_one(&dm_allocators[i], &b->res[i][n], size, reps, evict, evict_size);
+		}
+	}
+	page_frag_cache_drain(&dm_frag_cache);
+	vfree(evict);
+
+	b->nr_sizes = n;
+	b->valid = true;
+	return 0;
+}
+
+/* CSV, averages per repetition in ns */
+static void dm_sweep_bench_show(struct seq_file *s)
+{
+	struct dm_sweep_bench *b = &sweep_bench;
+	unsigned int i, n;
+
+	if(!b->valid)
+	{
+		seq_puts(s, "no results, write 1 to run the sweep\n");
+		return;
+	}
+	seq_puts(s, "allocator,size,reps,failures,alloc_ns,touch_ns,scan_ns,cold_ns,free_ns\n");
+	for(i = 0; i < DM_NR_ALLOCATORS; i++)
+	{
+		for(n = 0; n < b->nr_sizes; n++)
+		{
+			struct dm_sweep_result *r = &b->res[i][n];
+			unsigned int ok;
+
+			if(!r->reps)
+				continue;
+			ok = r->reps - r->failures;
+			seq_printf(s, "%s,%lu,%u,%u,%llu,%llu,%llu,%llu,%llu\n", dm_allocators[i].name,
+				   r->size, r->reps, r->failures,
+				   ok ? div_u64(r->alloc_ns, ok) : 0, ok ? div_u64(r->touch_ns, ok) : 0,
+				   ok ? div_u64(r->scan_ns, ok) : 0,
+				   r->cold_pages ? div64_u64(r->cold_ns, r->cold_pages) : 0,
+				   ok ? div_u64(r->free_ns, ok) : 0);
+		}
+	}
+}
+
+/* debugfs benchmark files, all serialized by dm_bench_lock */
+static const struct kt_bench_file dm_slab_bench_file = { &dm_bench_lock, dm_slab_bench_run, dm_slab_bench_show };
+static const struct kt_bench_file dm_atomic_bench_file = { &dm_bench_lock, dm_atomic_bench_run, dm_atomic_bench_show };
+static const struct kt_bench_file dm_sweep_bench_file = { &dm_bench_lock, dm_sweep_bench_run, dm_sweep_bench_show };
+static const struct kt_bench_file dm_scale_bench_file = { &dm_bench_lock, dm_scale_bench_run, dm_scale_bench_show };
+
+struct dentry *dm_debugfs_dir;
+
 static int __init module_dynamic_mem_init(void)
 {
+	slab_flags_t flags = hwcache_align ? SLAB_HWCACHE_ALIGN : 0;
+	int ret;
+
 	pr_info("Dynamically allocating the memory\r\n");
 	ptr = kmalloc(100* sizeof(int), GFP_KERNEL);
-	
+
 	if(!ptr)
 	{
 		pr_err("Failed memory allocation");
 		return -ENOMEM;
 	}
 	pr_info("Block of memory allocated!\r\n");
+
+	/* 1. the dedicated cache for the benchmark object */
+	if(obj_size < sizeof(struct dm_obj) || (obj_align && !is_power_of_2(obj_align)))
+	{
+		pr_err("invalid obj_size/obj_align\r\n");
+		ret = -EINVAL;
+		goto free_ptr;
+	}
+	dm_obj_cache = kmem_cache_create("dm_obj", obj_size, obj_align, flags, dm_obj_ctor);
+	if(!dm_obj_cache)
+	{
+		pr_err("kmem_cache_create failed\r\n");
+		ret = -ENOMEM;
+		goto free_ptr;
+	}
+
+	/* 2. the mempool for atomic context, backed by the same cache */
+	dm_pool = mempool_create_slab_pool(pool_min, dm_obj_cache);
+	if(!dm_pool)
+	{
+		pr_err("mempool_create failed\r\n");
+		ret = -ENOMEM;
+		goto destroy_cache;
+	}
+
+	/* 3. the per-cpu magazines in front of the cache */
+	ret = dm_mag_init();
+	if(ret)
+	{
+		pr_err("magazine init failed\r\n");
+		goto destroy_pool;
+	}
+
+	/* 4. benchmark control files */
+	dm_debugfs_dir = debugfs_create_dir("dynamic_mem", NULL);
+	kt_bench_create_file("slab_bench", dm_debugfs_dir, &dm_slab_bench_file);
+	kt_bench_create_file("mempool_bench", dm_debugfs_dir, &dm_atomic_bench_file);
+	kt_bench_create_file("alloc_sweep", dm_debugfs_dir, &dm_sweep_bench_file);
+	kt_bench_create_file("magazine_bench", dm_debugfs_dir, &dm_scale_bench_file);
 	return 0;
+
+destroy_pool:
+	mempool_destroy(dm_pool);
+destroy_cache:
+	kmem_cache_destroy(dm_obj_cache);
+free_ptr:
+	kfree(ptr);
+	return ret;
 }
 
 static void __exit module_dynamic_mem_exit(void)
 {
 	pr_info("De-allocating the memory\r\n");
+	debugfs_remove_recursive(dm_debugfs_dir);
+	dm_mag_destroy();
+	mempool_destroy(dm_pool);
+	kmem_cache_destroy(dm_obj_cache);
 	kfree(ptr);
 }
 
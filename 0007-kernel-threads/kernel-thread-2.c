@@ -3,9 +3,15 @@
 #include <linux/init.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include "kthread-sched.h"
 
 static struct task_struct *my_thread;
 
+/* policy, priority and cpus of my_thread, see kthread-sched.h */
+static struct kt_sched my_thread_sched;
+module_param_cb(my_thread_sched, &kt_sched_param_ops, &my_thread_sched, 0644);
+MODULE_PARM_DESC(my_thread_sched, "my_thread scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+
 static int thread_callback_fun(void *)
 {
 	int idx = 0;
@@ -30,6 +36,9 @@ static int __init module_thread_init(void)
 		pr_err("Failed to creat the thread :P\r\n");
 		return PTR_ERR(my_thread);
 	}
+	/* scheduling settings before it first runs */
+	kt_sched_attach(&my_thread_sched, my_thread);
+
 	/* start the thread in more control mannaer*/
 
 	wake_up_process(my_thread);
@@ -41,6 +50,7 @@ static void __exit module_thread_exit(void)
 {
 	pr_info("Thread module exit\r\n");
 	/* Terminating the thread*/
+	kt_sched_detach(&my_thread_sched);
 	kthread_stop(my_thread);
 }
 
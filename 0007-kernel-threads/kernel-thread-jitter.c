@@ -0,0 +1,301 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/completion.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "kthread-sched.h"
+#include "kthread-bench.h"
+
+/*
+ * Wake-up jitter of a periodic kthread under different scheduling settings
+ *
+ * For every setting in jitter_settings (';' separated, kthread-sched.h
+ * syntax) a thread sleeps until an absolute hrtimer deadline every period_us
+ * and records how late it actually ran. load_threads busy SCHED_NORMAL
+ * threads can run at the same time to compete for the cpus.
+ *   echo 1 > /sys/kernel/debug/kt_jitter/bench
+ *   cat /sys/kernel/debug/kt_jitter/bench
+ */
+char *jitter_settings = "normal;fifo:50;deadline:200/1000/1000;fifo:50@0";
+module_param(jitter_settings, charp, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(jitter_settings, "';' separated scheduling settings to compare");
+
+unsigned int period_us = 1000;
+module_param(period_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(period_us, "loop period in us (default 1000)");
+
+unsigned int samples = 2000;
+module_param(samples, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(samples, "wake-ups per setting (default 2000)");
+
+unsigned int load_threads;
+module_param(load_threads, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(load_threads, "busy SCHED_NORMAL threads during the run (default 0)");
+
+#define KJ_MAX_SETTINGS	8
+#define KJ_MAX_SAMPLES	1000000U
+#define KJ_MAX_LOAD	256U
+
+struct kj_result
+{
+	char setting[KT_SCHED_STR_LEN];
+	int error;
+	unsigned int samples;
+	u64 p50_ns;
+	u64 p99_ns;
+	u64 p999_ns;
+	u64 max_ns;
+};
+
+struct kj_bench
+{
+	bool valid;
+	unsigned int period_us;
+	unsigned int load_threads;
+	unsigned int nr;
+	struct kj_result res[KJ_MAX_SETTINGS];
+};
+
+struct kj_bench kj_bench;
+
+DEFINE_MUTEX(kj_bench_lock);
+
+/* one measuring thread */
+struct kj_run
+{
+	u64 *hist;	/* KT_HIST_BUCKETS(KT_HIST_BITS) buckets of lateness in ns */
+	u64 max_ns;
+	unsigned int samples;
+	ktime_t period;
+	struct completion done;
+};
+
+/* park until kthread_stop(), so the runner can always stop the thread safely */
+static void kj_wait_for_stop(void)
+{
+	while(!kthread_should_stop())
+	{
+		set_current_state(TASK_INTERRUPTIBLE);
+		if(!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+}
+
+static int kj_measure_fn(void *data)
+{
+	struct kj_run *run = data;
+	ktime_t next = ktime_add(ktime_get(), run->period);
+	ktime_t now;
+	unsigned int i;
+	u64 lat;
+
+	for(i = 0; i < run->samples && !kthread_should_stop(); i++)
+	{
+		/* sleep until the absolute deadline, then see how late we are */
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		schedule_hrtimeout(&next, HRTIMER_MODE_ABS);
+		now = ktime_get();
+		lat = ktime_to_ns(ktime_sub(now, next));
+		run->hist[kt_hist_bucket(lat, KT_HIST_BITS)]++;
+		run->max_ns = max(run->max_ns, lat);
+
+		next = ktime_add(next, run->period);
+		/* missed whole periods: restart from now instead of catching up */
+		if(ktime_before(next, now))
+			next = ktime_add(now, run->period);
+	}
+	run->samples = i;
+	complete(&run->done);
+	kj_wait_for_stop();
+	return 0;
+}
+
+static int kj_load_fn(void *data)
+{
+	while(!kthread_should_stop())
+	{
+		cpu_relax();
+		cond_resched();
+	}
+	return 0;
+}
+
+/* setting of the current run, runs are serialized by the bench lock */
+struct kt_sched kj_sched;
+
+/* run one setting, r->error is set when the setting could not be used */
+static void kj_run_setting(struct kj_result *r, const char *setting, struct kj_run *run)
+{
+	struct kt_sched *sched = &kj_sched;
+	struct task_struct *task;
+	unsigned int n;
+
+	memset(sched, 0, sizeof(*sched));
+	strscpy(r->setting, setting, sizeof(r->setting));
+	r->error = kt_sched_parse(sched, setting);
+	if(r->error)
+		return;
+
+	/* 1. create the thread and set it up before it first runs */
+	init_completion(&run->done);
+	task = kthread_create(kj_measure_fn, run, "kt_jitter");
+	if(IS_ERR(task))
+	{
+		r->error = PTR_ERR(task);
+		return;
+	}
+	sched->task = task;
+	r->error = kt_sched_apply(sched);
+	if(r->error)
+	{
+		/* a thread that never ran is just reaped */
+		kthread_stop(task);
+		return;
+	}
+
+	/* 2. measure */
+	wake_up_process(task);
+	wait_for_completion(&run->done);
+	kthread_stop(task);
+
+	/* 3. percentiles */
+	n = run->samples;
+	r->samples = n;
+	r->p50_ns = kt_hist_percentile(run->hist, KT_HIST_BITS, n, 500);
+	r->p99_ns = kt_hist_percentile(run->hist, KT_HIST_BITS, n, 990);
+	r->p999_ns = kt_hist_percentile(run->hist, KT_HIST_BITS, n, 999);
+	r->max_ns = run->max_ns;
+}
+
+static int kj_bench_run(void)
+{
+	struct kj_bench *b = &kj_bench;
+	struct task_struct **load = NULL;
+	struct kj_run run = { };
+	char *list, *cur, *setting;
+	unsigned int nr_load = load_threads, i;
+	int ret = 0;
+
+	if(!samples || samples > KJ_MAX_SAMPLES || !period_us || nr_load > KJ_MAX_LOAD)
+		return -EINVAL;
+
+	b->valid = false;
+	b->nr = 0;
+	b->period_us = period_us;
+	b->load_threads = nr_load;
+	run.period = us_to_ktime(period_us);
+
+	/* the parameter can be rewritten at any time, work on a copy */
+	kernel_param_lock(THIS_MODULE);
+	list = kstrdup(jitter_settings, GFP_KERNEL);
+	kernel_param_unlock(THIS_MODULE);
+	run.hist = kcalloc(KT_HIST_BUCKETS(KT_HIST_BITS), sizeof(u64), GFP_KERNEL);
+	if(nr_load)
+		load = kcalloc(nr_load, sizeof(*load), GFP_KERNEL);
+	if(!list || !run.hist || (nr_load && !load))
+	{
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	/* 1. background load */
+	for(i = 0; i < nr_load; i++)
+	{
+		load[i] = kthread_run(kj_load_fn, NULL, "kt_jitter_load/%u", i);
+		if(IS_ERR(load[i]))
+		{
+			ret = PTR_ERR(load[i]);
+			load[i] = NULL;
+			goto stop_load;
+		}
+	}
+
+	/* 2. every setting in turn */
+	cur = list;
+	while((setting = strsep(&cur, ";")) && b->nr < KJ_MAX_SETTINGS)
+	{
+		setting = strim(setting);
+		if(!*setting)
+			continue;
+		run.samples = samples;
+		run.max_ns = 0;
+		memset(run.hist, 0, KT_HIST_BUCKETS(KT_HIST_BITS) * sizeof(u64));
+		memset(&b->res[b->nr], 0, sizeof(b->res[b->nr]));
+		kj_run_setting(&b->res[b->nr], setting, &run);
+		b->nr++;
+	}
+	b->valid = true;
+
+stop_load:
+	for(i = 0; i < nr_load; i++)
+	{
+		if(load[i])
+			kthread_stop(load[i]);
+	}
+free:
+	kfree(load);
+	kfree(run.hist);
+	kfree(list);
+	return ret;
+}
+
+static void kj_bench_show(struct seq_file *s)
+{
+	struct kj_bench *b = &kj_bench;
+	unsigned int i;
+
+	if(!b->valid)
+	{
+		seq_puts(s, "no results, write 1 to run the benchmark\n");
+		return;
+	}
+	seq_printf(s, "period_us %u load_threads %u\n", b->period_us, b->load_threads);
+	seq_printf(s, "%-32s %8s %10s %10s %10s %10s\n", "setting", "samples", "p50_ns",
+		   "p99_ns", "p999_ns", "max_ns");
+	for(i = 0; i < b->nr; i++)
+	{
+		struct kj_result *r = &b->res[i];
+
+		if(r->error)
+		{
+			seq_printf(s, "%-32s error %d\n", r->setting, r->error);
+			continue;
+		}
+		seq_printf(s, "%-32s %8u %10llu %10llu %10llu %10llu\n", r->setting, r->samples,
+			   r->p50_ns, r->p99_ns, r->p999_ns, r->max_ns);
+	}
+}
+
+static const struct kt_bench_file kj_bench_file = { &kj_bench_lock, kj_bench_run, kj_bench_show };
+
+struct dentry *kj_debugfs_dir;
+
+static int __init kj_init(void)
+{
+	pr_info("Thread jitter module has been loaded\r\n");
+
+	kj_debugfs_dir = debugfs_create_dir("kt_jitter", NULL);
+	kt_bench_create_file("bench", kj_debugfs_dir, &kj_bench_file);
+	return 0;
+}
+
+static void __exit kj_exit(void)
+{
+	pr_info("Thread jitter module exited\r\n");
+	debugfs_remove_recursive(kj_debugfs_dir);
+}
+
+module_init(kj_init);
+module_exit(kj_exit);
+
+MODULE_DESCRIPTION("Kernel thread wake-up jitter under different scheduling settings");
+MODULE_AUTHOR("MahendraSondagar<mahendrasondagar08@gmail.com>");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");
@@ -0,0 +1,305 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/llist.h>
+#include <linux/rcupdate.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/slab.h>
+#include <linux/moduleparam.h>
+#include "kernel-thread-pool.h"
+
+/*
+ * One worker kthread per online cpu, created with kthread_create_on_cpu() and
+ * therefore bound to it. Every cpu has its own job queue, a lock-free llist:
+ * submitters push with llist_add(), the worker takes the whole list at once
+ * with llist_del_all(). A submit from the local cpu touches only that cpu's
+ * queue, there is no lock and no shared cacheline with other cpus.
+ *
+ * CPU hotplug: when a cpu goes down its worker is parked and the jobs still
+ * queued there move to another cpu; when it comes back the worker is
+ * unparked (and rebound) by kthread_unpark().
+ */
+struct kt_pool_cpu
+{
+	struct llist_head queue;
+	struct task_struct *worker;
+	/* cleared before the worker is parked, submitters then go elsewhere */
+	bool active;
+	unsigned long jobs_run;
+};
+
+DEFINE_PER_CPU(struct kt_pool_cpu, kt_pool_cpu);
+
+enum cpuhp_state kt_pool_hp_state;
+
+/* run everything queued on pc, in submission order */
+static bool kt_pool_run_queue(struct kt_pool_cpu *pc)
+{
+	struct llist_node *list = llist_del_all(&pc->queue);
+	struct kt_job *job, *tmp;
+
+	if(!list)
+		return false;
+	/* llist is LIFO, turn it back into FIFO */
+	list = llist_reverse_order(list);
+	llist_for_each_entry_safe(job, tmp, list, node)
+	{
+		job->fn(job);
+		pc->jobs_run++;
+	}
+	return true;
+}
+
+static int kt_pool_worker_fn(void *data)
+{
+	struct kt_pool_cpu *pc = data;
+
+	while(!kthread_should_stop())
+	{
+		if(kthread_should_park())
+		{
+			kthread_parkme();
+			continue;
+		}
+
+		/* sleep until a submitter finds the queue empty and wakes us */
+		set_current_state(TASK_INTERRUPTIBLE);
+		if(llist_empty(&pc->queue) && !kthread_should_stop() && !kthread_should_park())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		kt_pool_run_queue(pc);
+		cond_resched();
+	}
+
+	/* nothing may be left behind */
+	kt_pool_run_queue(pc);
+	return 0;
+}
+
+/* queue job on pc, wake the worker if the queue was empty */
+static void kt_pool_enqueue(struct kt_pool_cpu *pc, struct kt_job *job)
+{
+	if(llist_add(&job->node, &pc->queue))
+		wake_up_process(pc->worker);
+}
+
+/* an active cpu other than skip, or nr_cpu_ids if there is none */
+static unsigned int kt_pool_other_cpu(unsigned int skip)
+{
+	unsigned int cpu;
+
+	for_each_online_cpu(cpu)
+	{
+		if(cpu != skip && READ_ONCE(per_cpu(kt_pool_cpu, cpu).active))
+			return cpu;
+	}
+	return nr_cpu_ids;
+}
+
+void kt_pool_submit_on(unsigned int cpu, struct kt_job *job)
+{
+	struct kt_pool_cpu *pc;
+
+	/*
+	 * the active check and the enqueue form one RCU read side section
+	 * (preemption is disabled), the offline callback waits for it with
+	 * synchronize_rcu() before it drains the queue
+	 */
+	preempt_disable();
+	if(cpu >= nr_cpu_ids || !READ_ONCE(per_cpu(kt_pool_cpu, cpu).active))
+		cpu = kt_pool_other_cpu(nr_cpu_ids);
+	if(WARN_ON_ONCE(cpu >= nr_cpu_ids))
+	{
+		/* no worker at all, should not happen while the module is loaded */
+		preempt_enable();
+		job->fn(job);
+		return;
+	}
+	pc = per_cpu_ptr(&kt_pool_cpu, cpu);
+	kt_pool_enqueue(pc, job);
+	preempt_enable();
+}
+EXPORT_SYMBOL_GPL(kt_pool_submit_on);
+
+void kt_pool_submit(struct kt_job *job)
+{
+	kt_pool_submit_on(raw_smp_processor_id(), job);
+}
+EXPORT_SYMBOL_GPL(kt_pool_submit);
+
+/* cpu came online: start its worker, or wake the parked one */
+static int kt_pool_cpu_online(unsigned int cpu)
+{
+	struct kt_pool_cpu *pc = per_cpu_ptr(&kt_pool_cpu, cpu);
+	struct task_struct *task;
+
+	if(!pc->worker)
+	{
+		task = kthread_create_on_cpu(kt_pool_worker_fn, pc, cpu, "kt_pool/%u");
+		if(IS_ERR(task))
+		{
+			pr_err("kt_pool: worker for cpu %u not created\r\n", cpu);
+			return PTR_ERR(task);
+		}
+		pc->worker = task;
+		wake_up_process(task);
+	}
+	else
+	{
+		kthread_unpark(pc->worker);
+	}
+	WRITE_ONCE(pc->active, true);
+	return 0;
+}
+
+/* cpu goes offline: stop taking jobs, park the worker, hand leftovers to another cpu */
+static int kt_pool_cpu_offline(unsigned int cpu)
+{
+	struct kt_pool_cpu *pc = per_cpu_ptr(&kt_pool_cpu, cpu);
+	struct llist_node *list;
+	struct kt_job *job, *tmp;
+	unsigned int other;
+
+	/* 1. no new jobs, and wait for submitters that still saw the cpu active */
+	WRITE_ONCE(pc->active, false);
+	synchronize_rcu();
+
+	/* 2. park the worker */
+	kthread_park(pc->worker);
+
+	/* 3. requeue what is left, or run it here when this was the last cpu */
+	list = llist_reverse_order(llist_del_all(&pc->queue));
+	other = kt_pool_other_cpu(cpu);
+	llist_for_each_entry_safe(job, tmp, list, node)
+	{
+		if(other < nr_cpu_ids)
+			kt_pool_enqueue(per_cpu_ptr(&kt_pool_cpu, other), job);
+		else
+			job->fn(job);
+	}
+	return 0;
+}
+
+/*
+ * self test: selftest_jobs jobs are submitted to every online cpu, each one
+ * checks that it runs on the cpu it was queued on
+ */
+unsigned int selftest_jobs = 16;
+module_param(selftest_jobs, uint, S_IRUGO);
+MODULE_PARM_DESC(selftest_jobs, "jobs per cpu submitted at load time (default 16)");
+
+struct kt_selftest_job
+{
+	struct kt_job job;
+	unsigned int cpu;
+};
+
+atomic_t selftest_pending;
+atomic_t selftest_misplaced;
+DECLARE_COMPLETION(selftest_done);
+
+static void kt_selftest_fn(struct kt_job *job)
+{
+	struct kt_selftest_job *sj = container_of(job, struct kt_selftest_job, job);
+
+	if(raw_smp_processor_id() != sj->cpu)
+		atomic_inc(&selftest_misplaced);
+	if(atomic_dec_and_test(&selftest_pending))
+		complete(&selftest_done);
+}
+
+static void kt_pool_selftest(void)
+{
+	struct kt_selftest_job *jobs;
+	unsigned int cpu, i, n = 0, total;
+
+	cpus_read_lock();
+	total = selftest_jobs * num_online_cpus();
+	jobs = kcalloc(total, sizeof(*jobs), GFP_KERNEL);
+	if(!total || !jobs)
+	{
+		cpus_read_unlock();
+		kfree(jobs);
+		return;
+	}
+
+	atomic_set(&selftest_pending, total);
+	for_each_online_cpu(cpu)
+	{
+		for(i = 0; i < selftest_jobs; i++, n++)
+		{
+			jobs[n].cpu = cpu;
+			kt_job_init(&jobs[n].job, kt_selftest_fn);
+			kt_pool_submit_on(cpu, &jobs[n].job);
+		}
+	}
+	wait_for_completion(&selftest_done);
+	cpus_read_unlock();
+
+	pr_info("kt_pool: self test ran %u jobs, %d on the wrong cpu\r\n",
+		total, atomic_read(&selftest_misplaced));
+	kfree(jobs);
+}
+
+/* stop the (parked) workers, the queues are already drained */
+static void kt_pool_stop_workers(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		struct kt_pool_cpu *pc = per_cpu_ptr(&kt_pool_cpu, cpu);
+
+		if(!pc->worker)
+			continue;
+		kthread_stop(pc->worker);
+		pc->worker = NULL;
+		pr_info("kt_pool: cpu %u ran %lu jobs\r\n", cpu, pc->jobs_run);
+	}
+}
+
+static int __init kt_pool_init(void)
+{
+	int ret;
+
+	pr_info("Thread pool module has been loaded\r\n");
+
+	/* the online callback runs for every cpu that is already up */
+	ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "kt_pool:online",
+				kt_pool_cpu_online, kt_pool_cpu_offline);
+	if(ret < 0)
+	{
+		pr_err("cpu hotplug state setup failed\r\n");
+		kt_pool_stop_workers();
+		return ret;
+	}
+	kt_pool_hp_state = ret;
+
+	kt_pool_selftest();
+	return 0;
+}
+
+static void __exit kt_pool_exit(void)
+{
+	pr_info("Thread pool module exited\r\n");
+
+	/* 1. runs the offline callback on every cpu: workers parked, queues drained */
+	cpuhp_remove_state(kt_pool_hp_state);
+
+	/* 2. stop the parked workers */
+	kt_pool_stop_workers();
+}
+
+module_init(kt_pool_init);
+module_exit(kt_pool_exit);
+
+MODULE_DESCRIPTION("Per-cpu kernel thread worker pool");
+MODULE_AUTHOR("MahendraSondagar<mahendrasondagar08@gmail.com>");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");
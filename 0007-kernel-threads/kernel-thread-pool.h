@@ -0,0 +1,30 @@
+#ifndef KERNEL_THREAD_POOL_H
+#define KERNEL_THREAD_POOL_H
+
+#include <linux/llist.h>
+
+/*
+ * per-cpu kthread worker pool
+ *
+ * Embed a struct kt_job in your own object, set fn and submit it. fn runs
+ * once, in process context, on the worker thread of the cpu it was queued
+ * on; it may sleep and may free the containing object.
+ */
+struct kt_job
+{
+	struct llist_node node;
+	void (*fn)(struct kt_job *job);
+};
+
+static inline void kt_job_init(struct kt_job *job, void (*fn)(struct kt_job *job))
+{
+	job->fn = fn;
+}
+
+/* queue on the local cpu, the job runs with the submitter's caches still warm */
+void kt_pool_submit(struct kt_job *job);
+
+/* queue on a given cpu, falls back to another cpu of the pool if it is offline */
+void kt_pool_submit_on(unsigned int cpu, struct kt_job *job);
+
+#endif
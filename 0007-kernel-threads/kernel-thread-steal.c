@@ -0,0 +1,633 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/sched/task.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/cpumask.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "kthread-bench.h"
+
+/*
+ * Work-stealing executor
+ *
+ * Every worker kthread owns a Chase-Lev deque. The owner pushes and takes at
+ * the bottom without atomics in the common case; idle workers steal from the
+ * top of a random peer's deque with one cmpxchg. For comparison the same
+ * workers can run from a single spinlock-protected shared queue.
+ *
+ * The benchmark runs imbalanced fan-out/fan-in task graphs: every node of a
+ * graph with remaining depth r > 0 spawns graph_fanout children with depth
+ * (r - 1) >> i, so child 0 carries most of the work and the others get
+ * exponentially smaller subtrees. A parent completes (fan-in) when its last
+ * child is done. All roots start on worker 0, the others have to steal.
+ *   echo 1 > /sys/kernel/debug/kt_steal/bench
+ *   cat /sys/kernel/debug/kt_steal/bench
+ */
+unsigned int nr_workers;
+module_param(nr_workers, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(nr_workers, "worker threads (default 0: one per online cpu)");
+
+unsigned int graph_roots = 64;
+module_param(graph_roots, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(graph_roots, "task graphs per run (default 64)");
+
+unsigned int graph_depth = 10;
+module_param(graph_depth, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(graph_depth, "depth of a task graph (default 10)");
+
+unsigned int graph_fanout = 4;
+module_param(graph_fanout, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(graph_fanout, "children per inner node (default 4)");
+
+unsigned int task_spin = 200;
+module_param(task_spin, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(task_spin, "busy loop iterations per task (default 200)");
+
+unsigned int deque_order = 14;
+module_param(deque_order, uint, S_IRUGO);
+MODULE_PARM_DESC(deque_order, "log2 of the deque capacity per worker (default 14)");
+
+#define WS_MAX_DEPTH	24U
+#define WS_MAX_FANOUT	16U
+#define WS_MAX_NODES	(4U << 20)
+/* nodes a worker takes from the shared pool at once */
+#define WS_NODE_CHUNK	256U
+
+/* one node of a task graph, it is also the unit of work */
+struct ws_node
+{
+	struct list_head list;		/* shared queue only */
+	struct ws_node *parent;
+	atomic_t pending;		/* children not done yet */
+	unsigned int rem;		/* remaining depth below this node */
+	u64 queued_ns;
+};
+
+/*
+ * Chase-Lev deque, fixed capacity. top and bottom only grow, the slot is
+ * index & mask. The owner works at the bottom, thieves at the top; the only
+ * race between them is over the last element, settled by cmpxchg on top.
+ */
+struct ws_deque
+{
+	atomic_long_t top ____cacheline_aligned_in_smp;
+	atomic_long_t bottom ____cacheline_aligned_in_smp;
+	struct ws_node **buf;
+	long mask;
+};
+
+static int ws_deque_init(struct ws_deque *dq, unsigned int order)
+{
+	dq->buf = kvcalloc(1UL << order, sizeof(*dq->buf), GFP_KERNEL);
+	if(!dq->buf)
+		return -ENOMEM;
+	dq->mask = (1L << order) - 1;
+	atomic_long_set(&dq->top, 0);
+	atomic_long_set(&dq->bottom, 0);
+	return 0;
+}
+
+static void ws_deque_free(struct ws_deque *dq)
+{
+	kvfree(dq->buf);
+	dq->buf = NULL;
+}
+
+/* owner only, false when full */
+static bool ws_deque_push(struct ws_deque *dq, struct ws_node *node)
+{
+	long b = atomic_long_read(&dq->bottom);
+	long t = atomic_long_read_acquire(&dq->top);
+
+	if(b - t > dq->mask)
+		return false;
+	WRITE_ONCE(dq->buf[b & dq->mask], node);
+	/* the slot must be visible before a thief can see the new bottom */
+	atomic_long_set_release(&dq->bottom, b + 1);
+	return true;
+}
+
+/* owner only, LIFO end */
+static struct ws_node *ws_deque_take(struct ws_deque *dq)
+{
+	long b = atomic_long_read(&dq->bottom) - 1;
+	struct ws_node *node;
+	long t;
+
+	/* reserve the bottom slot, then look at top: needs a full barrier */
+	atomic_long_set(&dq->bottom, b);
+	smp_mb();
+	t = atomic_long_read(&dq->top);
+
+	if(t > b)
+	{
+		/* empty */
+		atomic_long_set(&dq->bottom, b + 1);
+		return NULL;
+	}
+
+	node = READ_ONCE(dq->buf[b & dq->mask]);
+	if(t == b)
+	{
+		/* last element, race the thieves for it */
+		if(!atomic_long_try_cmpxchg(&dq->top, &t, t + 1))
+			node = NULL;
+		atomic_long_set(&dq->bottom, b + 1);
+	}
+	return node;
+}
+
+/* any thread, FIFO end; NULL when empty or when another thief won */
+static struct ws_node *ws_deque_steal(struct ws_deque *dq)
+{
+	long t = atomic_long_read_acquire(&dq->top);
+	struct ws_node *node;
+	long b;
+
+	smp_mb();
+	b = atomic_long_read_acquire(&dq->bottom);
+	if(t >= b)
+		return NULL;
+
+	node = READ_ONCE(dq->buf[t & dq->mask]);
+	if(!atomic_long_try_cmpxchg(&dq->top, &t, t + 1))
+		return NULL;
+	return node;
+}
+
+enum ws_mode
+{
+	WS_STEAL,
+	WS_SHARED,
+	WS_NR_MODES
+};
+
+const char *ws_mode_names[WS_NR_MODES] = { "steal", "shared" };
+
+struct ws_exec;
+
+struct ws_worker
+{
+	struct ws_deque dq;
+	struct ws_exec *ex;
+	struct task_struct *task;
+	unsigned int idx;
+	u64 tasks;
+	u64 steals;
+	u64 steal_attempts;
+	u64 inline_runs;
+	u64 max_ns;
+	u64 hist[KT_HIST_BUCKETS(KT_HIST_BITS)];	/* queue latency in ns */
+	/* private node arena, refilled WS_NODE_CHUNK nodes at a time */
+	struct ws_node *next_node;
+	struct ws_node *end_node;
+} ____cacheline_aligned_in_smp;
+
+struct ws_exec
+{
+	enum ws_mode mode;
+	unsigned int nr;
+	unsigned int fanout;
+	unsigned int spin;
+	struct ws_worker *workers;
+
+	/* the shared queue design */
+	spinlock_t shared_lock;
+	struct list_head shared;
+
+	/*
+	 * preallocated graph nodes: the roots, then chunks handed out to the
+	 * workers' arenas, so spawning a task touches no shared cacheline
+	 */
+	struct ws_node *nodes;
+	unsigned int nr_nodes;
+	atomic_t next_node;
+
+	atomic_t roots_left;
+	bool done;
+	struct completion start;
+	struct completion finished;
+	atomic_t running;
+};
+
+static void ws_spin(unsigned int n)
+{
+	while(n--)
+		cpu_relax();
+}
+
+static void ws_run(struct ws_exec *ex, struct ws_worker *w, struct ws_node *node);
+
+static void ws_push(struct ws_exec *ex, struct ws_worker *w, struct ws_node *node)
+{
+	node->queued_ns = ktime_get_ns();
+
+	if(ex->mode == WS_SHARED)
+	{
+		spin_lock(&ex->shared_lock);
+		list_add_tail(&node->list, &ex->shared);
+		spin_unlock(&ex->shared_lock);
+		return;
+	}
+
+	/* deque full: run the child right away, like a function call */
+	if(!ws_deque_push(&w->dq, node))
+	{
+		w->inline_runs++;
+		ws_run(ex, w, node);
+	}
+}
+
+static struct ws_node *ws_get(struct ws_exec *ex, struct ws_worker *w)
+{
+	struct ws_node *node;
+	unsigned int i, start;
+
+	if(ex->mode == WS_SHARED)
+	{
+		spin_lock(&ex->shared_lock);
+		node = list_first_entry_or_null(&ex->shared, struct ws_node, list);
+		if(node)
+			list_del(&node->list);
+		spin_unlock(&ex->shared_lock);
+		return node;
+	}
+
+	/* 1. own deque first, newest task, still hot in the cache */
+	node = ws_deque_take(&w->dq);
+	if(node || ex->nr == 1)
+		return node;
+
+	/* 2. steal the oldest task of a random peer, it is the biggest subtree */
+	start = get_random_u32_below(ex->nr);
+	for(i = 0; i < ex->nr; i++)
+	{
+		unsigned int victim = (start + i) % ex->nr;
+
+		if(victim == w->idx)
+			continue;
+		w->steal_attempts++;
+		node = ws_deque_steal(&ex->workers[victim].dq);
+		if(node)
+		{
+			w->steals++;
+			return node;
+		}
+	}
+	return NULL;
+}
+
+/* node and all its children are done, propagate towards the root */
+static void ws_node_done(struct ws_exec *ex, struct ws_node *node)
+{
+	struct ws_node *parent;
+
+	while(node)
+	{
+		parent = node->parent;
+		if(!parent)
+		{
+			if(atomic_dec_and_test(&ex->roots_left))
+				WRITE_ONCE(ex->done, true);
+			return;
+		}
+		/* fan-in: the last child to finish completes the parent */
+		if(!atomic_dec_and_test(&parent->pending))
+			return;
+		ws_spin(ex->spin);
+		node = parent;
+	}
+}
+
+/* a node for a new task, from the worker's own arena */
+static struct ws_node *ws_node_alloc(struct ws_exec *ex, struct ws_worker *w)
+{
+	unsigned int first;
+
+	if(w->next_node == w->end_node)
+	{
+		/* always fits, nr_nodes has room for a partly used chunk per worker */
+		first = atomic_add_return(WS_NODE_CHUNK, &ex->next_node) - WS_NODE_CHUNK;
+		w->next_node = &ex->nodes[first];
+		w->end_node = w->next_node + WS_NODE_CHUNK;
+	}
+	return w->next_node++;
+}
+
+static void ws_run(struct ws_exec *ex, struct ws_worker *w, struct ws_node *node)
+{
+	u64 lat = ktime_get_ns() - node->queued_ns;
+	unsigned int i;
+
+	w->tasks++;
+	w->hist[kt_hist_bucket(lat, KT_HIST_BITS)]++;
+	if(lat > w->max_ns)
+		w->max_ns = lat;
+
+	ws_spin(ex->spin);
+
+	if(!node->rem)
+	{
+		ws_node_done(ex, node);
+		return;
+	}
+
+	/* fan-out: pending has to be set before the first child can finish */
+	atomic_set(&node->pending, ex->fanout);
+	for(i = 0; i < ex->fanout; i++)
+	{
+		struct ws_node *child = ws_node_alloc(ex, w);
+
+		child->parent = node;
+		child->rem = (node->rem - 1) >> i;
+		ws_push(ex, w, child);
+	}
+}
+
+static int ws_worker_fn(void *data)
+{
+	struct ws_worker *w = data;
+	struct ws_exec *ex = w->ex;
+	struct ws_node *node;
+	unsigned long idle = 0;
+
+	wait_for_completion(&ex->start);
+	while(!READ_ONCE(ex->done))
+	{
+		node = ws_get(ex, w);
+		if(node)
+		{
+			ws_run(ex, w, node);
+			continue;
+		}
+		cpu_relax();
+		if(!(++idle & 1023))
+			cond_resched();
+	}
+	if(atomic_dec_and_test(&ex->running))
+		complete(&ex->finished);
+	return 0;
+}
+
+/* nodes in a graph of the given depth, saturates at WS_MAX_NODES + 1 */
+static unsigned long ws_graph_nodes(unsigned int depth, unsigned int fanout)
+{
+	unsigned long n[WS_MAX_DEPTH + 1];
+	unsigned int r, i;
+
+	n[0] = 1;
+	for(r = 1; r <= depth; r++)
+	{
+		n[r] = 1;
+		for(i = 0; i < fanout; i++)
+			n[r] = min(n[r] + n[(r - 1) >> i], WS_MAX_NODES + 1UL);
+	}
+	return n[depth];
+}
+
+/* results of the last run, per mode */
+struct ws_result
+{
+	bool valid;
+	unsigned int workers;
+	u64 tasks;
+	u64 elapsed_ns;
+	u64 steals;
+	u64 steal_attempts;
+	u64 inline_runs;
+	u64 p50_ns;
+	u64 p99_ns;
+	u64 p999_ns;
+	u64 max_ns;
+};
+
+struct ws_result ws_results[WS_NR_MODES];
+unsigned int ws_last_roots, ws_last_depth, ws_last_fanout, ws_last_spin;
+
+DEFINE_MUTEX(ws_bench_lock);
+
+static int ws_bench_one(enum ws_mode mode, unsigned int nr, unsigned int roots,
+			unsigned int depth, unsigned int fanout, unsigned int spin,
+			unsigned long per_graph)
+{
+	struct ws_result *res = &ws_results[mode];
+	struct ws_exec *ex;
+	u64 *hist;
+	unsigned int i, created = 0;
+	ktime_t t0;
+	u64 elapsed;
+	int ret = 0;
+
+	ex = kzalloc(sizeof(*ex), GFP_KERNEL);
+	if(!ex)
+		return -ENOMEM;
+	ex->mode = mode;
+	ex->nr = nr;
+	ex->fanout = fanout;
+	ex->spin = spin;
+	spin_lock_init(&ex->shared_lock);
+	INIT_LIST_HEAD(&ex->shared);
+	init_completion(&ex->start);
+	init_completion(&ex->finished);
+
+	/* 1. the nodes of all graphs, plus the unused tail of each worker's last chunk, and the workers */
+	ex->nr_nodes = roots * per_graph + nr * WS_NODE_CHUNK;
+	ex->nodes = vzalloc(array_size(ex->nr_nodes, sizeof(*ex->nodes)));
+	ex->workers = kcalloc(nr, sizeof(*ex->workers), GFP_KERNEL);
+	if(!ex->nodes || !ex->workers)
+	{
+		ret = -ENOMEM;
+		goto free;
+	}
+	for(i = 0; i < nr; i++)
+	{
+		ex->workers[i].ex = ex;
+		ex->workers[i].idx = i;
+		ret = ws_deque_init(&ex->workers[i].dq, deque_order);
+		if(ret)
+			goto free;
+	}
+
+	/* 2. the roots, all on worker 0 (or the shared queue); they fit, roots <= deque capacity */
+	atomic_set(&ex->roots_left, roots);
+	atomic_set(&ex->next_node, roots);
+	for(i = 0; i < roots; i++)
+	{
+		ex->nodes[i].rem = depth;
+		ws_push(ex, &ex->workers[0], &ex->nodes[i]);
+	}
+
+	/* 3. one bound worker per cpu */
+	atomic_set(&ex->running, nr);
+	for(i = 0; i < nr; i++)
+	{
+		struct ws_worker *w = &ex->workers[i];
+
+		w->task = kthread_create(ws_worker_fn, w, "kt_steal/%u", i);
+		if(IS_ERR(w->task))
+		{
+			ret = PTR_ERR(w->task);
+			w->task = NULL;
+			break;
+		}
+		kthread_bind(w->task, cpumask_nth(i % num_online_cpus(), cpu_online_mask));
+		get_task_struct(w->task);
+		wake_up_process(w->task);
+		created++;
+	}
+	if(ret)
+	{
+		/* let the ones that exist finish right away */
+		WRITE_ONCE(ex->done, true);
+		if(atomic_sub_and_test(nr - created, &ex->running))
+			complete(&ex->finished);
+	}
+
+	/* 4. go, the roots are queued from now on: thread creation is not queue latency */
+	t0 = ktime_get();
+	for(i = 0; i < roots; i++)
+		ex->nodes[i].queued_ns = ktime_to_ns(t0);
+	complete_all(&ex->start);
+	wait_for_completion(&ex->finished);
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+	for(i = 0; i < created; i++)
+	{
+		kthread_stop(ex->workers[i].task);
+		put_task_struct(ex->workers[i].task);
+	}
+	if(ret)
+		goto free;
+
+	/* 5. collect, every histogram is merged into the first one */
+	memset(res, 0, sizeof(*res));
+	hist = ex->workers[0].hist;
+	for(i = 0; i < nr; i++)
+	{
+		struct ws_worker *w = &ex->workers[i];
+		unsigned int b;
+
+		res->tasks += w->tasks;
+		res->steals += w->steals;
+		res->steal_attempts += w->steal_attempts;
+		res->inline_runs += w->inline_runs;
+		res->max_ns = max(res->max_ns, w->max_ns);
+		if(i)
+		{
+			for(b = 0; b < KT_HIST_BUCKETS(KT_HIST_BITS); b++)
+				hist[b] += w->hist[b];
+		}
+	}
+	res->elapsed_ns = elapsed;
+	res->p50_ns = kt_hist_percentile(hist, KT_HIST_BITS, res->tasks, 500);
+	res->p99_ns = kt_hist_percentile(hist, KT_HIST_BITS, res->tasks, 990);
+	res->p999_ns = kt_hist_percentile(hist, KT_HIST_BITS, res->tasks, 999);
+	res->workers = nr;
+	res->valid = true;
+
+free:
+	if(ex->workers)
+	{
+		for(i = 0; i < nr; i++)
+			ws_deque_free(&ex->workers[i].dq);
+	}
+	kfree(ex->workers);
+	vfree(ex->nodes);
+	kfree(ex);
+	return ret;
+}
+
+static int ws_bench_run(void)
+{
+	unsigned int nr = nr_workers ? nr_workers : num_online_cpus();
+	unsigned int roots = graph_roots, depth = graph_depth;
+	unsigned int fanout = graph_fanout, spin = task_spin;
+	unsigned long per_graph;
+	int mode, ret;
+
+	if(!nr || nr > 4 * num_online_cpus() || !roots || depth > WS_MAX_DEPTH ||
+	   !fanout || fanout > WS_MAX_FANOUT || deque_order < 4 || deque_order > 24 ||
+	   roots > (1U << deque_order))
+		return -EINVAL;
+	per_graph = ws_graph_nodes(depth, fanout);
+	if(per_graph > WS_MAX_NODES / roots)
+		return -E2BIG;
+
+	ws_last_roots = roots;
+	ws_last_depth = depth;
+	ws_last_fanout = fanout;
+	ws_last_spin = spin;
+	for(mode = 0; mode < WS_NR_MODES; mode++)
+	{
+		ws_results[mode].valid = false;
+		ret = ws_bench_one(mode, nr, roots, depth, fanout, spin, per_graph);
+		if(ret)
+			return ret;
+	}
+	return 0;
+}
+
+static void ws_bench_show(struct seq_file *s)
+{
+	int mode;
+
+	seq_printf(s, "roots %u depth %u fanout %u task_spin %u\n",
+		   ws_last_roots, ws_last_depth, ws_last_fanout, ws_last_spin);
+	seq_printf(s, "%-7s %7s %10s %10s %10s %10s %10s %10s %10s %10s %8s\n", "mode", "workers",
+		   "tasks", "elapsed_us", "ktasks_s", "p50_ns", "p99_ns", "p999_ns", "max_ns",
+		   "steals", "inline");
+	for(mode = 0; mode < WS_NR_MODES; mode++)
+	{
+		struct ws_result *r = &ws_results[mode];
+
+		if(!r->valid)
+		{
+			seq_printf(s, "%-7s no results, write 1 to run the benchmark\n", ws_mode_names[mode]);
+			continue;
+		}
+		seq_printf(s, "%-7s %7u %10llu %10llu %10llu %10llu %10llu %10llu %10llu %10llu %8llu\n",
+			   ws_mode_names[mode], r->workers, r->tasks, div_u64(r->elapsed_ns, NSEC_PER_USEC),
+			   r->elapsed_ns ? div64_u64(r->tasks * USEC_PER_SEC, r->elapsed_ns) : 0,
+			   r->p50_ns, r->p99_ns, r->p999_ns, r->max_ns, r->steals, r->inline_runs);
+	}
+}
+
+/* a write runs both designs */
+static const struct kt_bench_file ws_bench_file = { &ws_bench_lock, ws_bench_run, ws_bench_show };
+
+struct dentry *ws_debugfs_dir;
+
+static int __init ws_init(void)
+{
+	pr_info("Work stealing module has been loaded\r\n");
+
+	ws_debugfs_dir = debugfs_create_dir("kt_steal", NULL);
+	kt_bench_create_file("bench", ws_debugfs_dir, &ws_bench_file);
+	return 0;
+}
+
+static void __exit ws_exit(void)
+{
+	pr_info("Work stealing module exited\r\n");
+	debugfs_remove_recursive(ws_debugfs_dir);
+}
+
+module_init(ws_init);
+module_exit(ws_exit);
+
+MODULE_DESCRIPTION("Work stealing executor on kernel threads");
+MODULE_AUTHOR("MahendraSondagar<mahendrasondagar08@gmail.com>");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");
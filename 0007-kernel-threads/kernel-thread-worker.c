@@ -0,0 +1,324 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "kthread-bench.h"
+
+/*
+ * Event driven replacement for the polling loops of the thread examples
+ *
+ *	while(!kthread_should_stop())
+ *	{
+ *		do_work();
+ *		ssleep(1);
+ *	}
+ *
+ * wakes up every second whether there is work or not, and work that shows
+ * up right after a wakeup waits almost a full second. A kthread_worker only
+ * wakes up when work is queued on it, and runs it at once; periodic jobs are
+ * kthread_delayed_work that re-queue themselves.
+ */
+unsigned int period_ms = 1000;
+module_param(period_ms, uint, S_IRUGO);
+MODULE_PARM_DESC(period_ms, "period of the periodic job in ms (default 1000)");
+
+struct kthread_worker *my_worker;
+struct kthread_delayed_work periodic_work;
+int count;
+
+/* same job as thread_callback_fun() in kernel-thread.c, without the loop */
+static void periodic_work_fn(struct kthread_work *work)
+{
+	pr_info("kthread worker iterations: %d\r\n", count++);
+
+	/* re-arm, the worker sleeps until then */
+	kthread_queue_delayed_work(my_worker, &periodic_work, msecs_to_jiffies(period_ms));
+}
+
+/*
+ * same job as thread_callback_fun() in kernel-thread-2.c. That example
+ * creates its thread stopped and starts it with wake_up_process() once it is
+ * set up; an idle worker does not run anything either, so queueing the first
+ * run is the start.
+ */
+struct kthread_delayed_work iteration_work;
+int idx;
+
+static void iteration_work_fn(struct kthread_work *work)
+{
+	pr_info("kthread iterations: %d\r\n", idx++);
+	kthread_queue_delayed_work(my_worker, &iteration_work, msecs_to_jiffies(period_ms));
+}
+
+/*
+ * benchmark: polling loop vs kthread_worker
+ *
+ * Both designs get the same bench_events events, event_interval_ms apart.
+ * An event is a timestamp: the polling thread finds it at its next wakeup,
+ * the worker gets a kthread_work queued. Reported are enqueue-to-execute
+ * latency, events that were merged into a still pending one, and wakeups per
+ * second (context switches of the thread over the run).
+ *   echo 1 > /sys/kernel/debug/kt_worker/bench
+ *   cat /sys/kernel/debug/kt_worker/bench
+ */
+unsigned int poll_ms = 1000;
+module_param(poll_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(poll_ms, "sleep of the polling loop in ms, ssleep(1) in the examples (default 1000)");
+
+unsigned int bench_events = 50;
+module_param(bench_events, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(bench_events, "events per benchmark run (default 50)");
+
+unsigned int event_interval_ms = 200;
+module_param(event_interval_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(event_interval_ms, "time between two events in ms (default 200)");
+
+#define KW_MAX_EVENTS	100000U
+
+enum kw_design
+{
+	KW_POLL,
+	KW_WORKER,
+	KW_NR_DESIGNS
+};
+
+const char *kw_design_names[KW_NR_DESIGNS] = { "poll", "kthread_worker" };
+
+/* one consumer of the events */
+struct kw_consumer
+{
+	/* enqueue time of the pending event, 0: none */
+	atomic64_t pending;
+	u64 hist[KT_HIST_BUCKETS(KT_HIST_BITS)];	/* enqueue-to-execute latency in ns */
+	u64 max_ns;
+	unsigned int executed;
+	unsigned int merged;
+	unsigned long switches;
+};
+
+struct kw_result
+{
+	unsigned int events;
+	unsigned int executed;
+	unsigned int merged;
+	u64 wakeups_x100;	/* per second, two decimals */
+	u64 p50_ns;
+	u64 p99_ns;
+	u64 max_ns;
+};
+
+struct kw_bench
+{
+	bool valid;
+	unsigned int poll_ms;
+	unsigned int interval_ms;
+	struct kw_consumer c[KW_NR_DESIGNS];
+	struct kw_result res[KW_NR_DESIGNS];
+	struct kthread_work work;
+};
+
+struct kw_bench kw_bench;
+
+DEFINE_MUTEX(kw_bench_lock);
+
+static void kw_consume(struct kw_consumer *c, unsigned int max)
+{
+	u64 queued = atomic64_xchg(&c->pending, 0);
+
+	u64 lat;
+
+	if(!queued || c->executed >= max)
+		return;
+	lat = ktime_get_ns() - queued;
+	c->hist[kt_hist_bucket(lat, KT_HIST_BITS)]++;
+	c->max_ns = max(c->max_ns, lat);
+	c->executed++;
+}
+
+/* the polling loop, exactly like the examples but with a configurable sleep */
+static int kw_poll_fn(void *data)
+{
+	unsigned int max = kw_bench.res[KW_POLL].events;
+
+	while(!kthread_should_stop())
+	{
+		kw_consume(&kw_bench.c[KW_POLL], max);
+		msleep_interruptible(kw_bench.poll_ms);
+	}
+	return 0;
+}
+
+static void kw_work_fn(struct kthread_work *work)
+{
+	kw_consume(&kw_bench.c[KW_WORKER], kw_bench.res[KW_WORKER].events);
+}
+
+static unsigned long kw_switches(struct task_struct *task)
+{
+	return READ_ONCE(task->nvcsw) + READ_ONCE(task->nivcsw);
+}
+
+static int kw_bench_run(void)
+{
+	struct kw_bench *b = &kw_bench;
+	struct kthread_worker *worker;
+	struct task_struct *poller;
+	unsigned int events = bench_events, i;
+	ktime_t t0;
+	u64 elapsed;
+	int d;
+
+	if(!events || events > KW_MAX_EVENTS || !poll_ms)
+		return -EINVAL;
+
+	b->valid = false;
+	b->poll_ms = poll_ms;
+	b->interval_ms = event_interval_ms;
+	for(d = 0; d < KW_NR_DESIGNS; d++)
+	{
+		memset(&b->res[d], 0, sizeof(b->res[d]));
+		b->res[d].events = events;
+		memset(&b->c[d], 0, sizeof(b->c[d]));
+	}
+
+	/* 1. the two consumers */
+	worker = kthread_create_worker(0, "kt_worker_bench");
+	if(IS_ERR(worker))
+		return PTR_ERR(worker);
+	kthread_init_work(&b->work, kw_work_fn);
+
+	poller = kthread_run(kw_poll_fn, NULL, "kt_poll_bench");
+	if(IS_ERR(poller))
+	{
+		kthread_destroy_worker(worker);
+		return PTR_ERR(poller);
+	}
+
+	/* 2. produce the events */
+	t0 = ktime_get();
+	b->c[KW_POLL].switches = kw_switches(poller);
+	b->c[KW_WORKER].switches = kw_switches(worker->task);
+	for(i = 0; i < events; i++)
+	{
+		u64 now;
+
+		msleep(b->interval_ms);
+		now = ktime_get_ns();
+
+		if(atomic64_cmpxchg(&b->c[KW_POLL].pending, 0, now))
+			b->c[KW_POLL].merged++;
+
+		if(atomic64_cmpxchg(&b->c[KW_WORKER].pending, 0, now))
+			b->c[KW_WORKER].merged++;
+		else
+			kthread_queue_work(worker, &b->work);
+	}
+
+	/* 3. give the polling loop one more round to pick up the last event */
+	kthread_flush_work(&b->work);
+	msleep(b->poll_ms + 10);
+
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), t0));
+	b->c[KW_POLL].switches = kw_switches(poller) - b->c[KW_POLL].switches;
+	b->c[KW_WORKER].switches = kw_switches(worker->task) - b->c[KW_WORKER].switches;
+
+	kthread_stop(poller);
+	kthread_destroy_worker(worker);
+
+	/* 4. results */
+	for(d = 0; d < KW_NR_DESIGNS; d++)
+	{
+		struct kw_consumer *c = &b->c[d];
+		struct kw_result *r = &b->res[d];
+
+		r->executed = c->executed;
+		r->merged = c->merged;
+		r->wakeups_x100 = div64_u64((u64)c->switches * 100 * NSEC_PER_SEC, elapsed);
+		r->p50_ns = kt_hist_percentile(c->hist, KT_HIST_BITS, c->executed, 500);
+		r->p99_ns = kt_hist_percentile(c->hist, KT_HIST_BITS, c->executed, 990);
+		r->max_ns = c->max_ns;
+	}
+	b->valid = true;
+	return 0;
+}
+
+static void kw_bench_show(struct seq_file *s)
+{
+	struct kw_bench *b = &kw_bench;
+	int d;
+
+	if(!b->valid)
+	{
+		seq_puts(s, "no results, write 1 to run the benchmark\n");
+		return;
+	}
+	seq_printf(s, "poll_ms %u event_interval_ms %u\n", b->poll_ms, b->interval_ms);
+	seq_printf(s, "%-15s %8s %8s %8s %10s %10s %10s %10s\n", "design", "events", "executed",
+		   "merged", "wakeups_s", "p50_us", "p99_us", "max_us");
+	for(d = 0; d < KW_NR_DESIGNS; d++)
+	{
+		struct kw_result *r = &b->res[d];
+		u32 frac;
+		u64 whole = div_u64_rem(r->wakeups_x100, 100, &frac);
+
+		seq_printf(s, "%-15s %8u %8u %8u %7llu.%02u %10llu %10llu %10llu\n", kw_design_names[d],
+			   r->events, r->executed, r->merged, whole, frac, div_u64(r->p50_ns, NSEC_PER_USEC),
+			   div_u64(r->p99_ns, NSEC_PER_USEC), div_u64(r->max_ns, NSEC_PER_USEC));
+	}
+}
+
+static const struct kt_bench_file kw_bench_file = { &kw_bench_lock, kw_bench_run, kw_bench_show };
+
+struct dentry *kw_debugfs_dir;
+
+static int __init kw_init(void)
+{
+	pr_info("Thread worker module has been loaded\r\n");
+
+	/* 1. one worker thread, it sleeps while there is no work */
+	my_worker = kthread_create_worker(0, "my_worker");
+	if(IS_ERR(my_worker))
+	{
+		pr_err("Worker creation failed!\r\n");
+		return PTR_ERR(my_worker);
+	}
+
+	/* 2. the periodic jobs of both polling examples, first runs right away */
+	kthread_init_delayed_work(&periodic_work, periodic_work_fn);
+	kthread_init_delayed_work(&iteration_work, iteration_work_fn);
+	kthread_queue_delayed_work(my_worker, &periodic_work, 0);
+	kthread_queue_delayed_work(my_worker, &iteration_work, 0);
+
+	/* 3. benchmark control file */
+	kw_debugfs_dir = debugfs_create_dir("kt_worker", NULL);
+	kt_bench_create_file("bench", kw_debugfs_dir, &kw_bench_file);
+	return 0;
+}
+
+static void __exit kw_exit(void)
+{
+	pr_info("Thread worker module exited\r\n");
+	debugfs_remove_recursive(kw_debugfs_dir);
+
+	/* cancel waits for a running instance, which can no longer re-arm */
+	kthread_cancel_delayed_work_sync(&periodic_work);
+	kthread_cancel_delayed_work_sync(&iteration_work);
+	kthread_destroy_worker(my_worker);
+}
+
+module_init(kw_init);
+module_exit(kw_exit);
+
+MODULE_DESCRIPTION("Event driven kernel thread worker");
+MODULE_AUTHOR("MahendraSondagar<mahendrasondagar08@gmail.com>");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");
@@ -3,10 +3,16 @@
 #include <linux/init.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include "kthread-sched.h"
 
 
 static struct task_struct *my_thread;
 
+/* policy, priority and cpus of my_thread, see kthread-sched.h */
+static struct kt_sched my_thread_sched;
+module_param_cb(my_thread_sched, &kt_sched_param_ops, &my_thread_sched, 0644);
+MODULE_PARM_DESC(my_thread_sched, "my_thread scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+
 static int thread_callback_fun(void *)
 {
 	int count =0;
@@ -40,6 +46,7 @@ static int __init my_thread_mod_init(void)
 		pr_err("Thread creation failed!\r\n");
 		return (PTR_ERR(my_thread));
 	}
+	kt_sched_attach(&my_thread_sched, my_thread);
 	return 0;
 }
 
@@ -50,6 +57,7 @@ static void __exit my_thread_mod_exit(void)
 	/* stopping the running thread*/ 
 	if(my_thread)
 	{
+		kt_sched_detach(&my_thread_sched);
 		kthread_stop(my_thread);
 		pr_info("stopping the thread :p");
 	}
@@ -0,0 +1,145 @@
+#ifndef KTHREAD_BENCH_H
+#define KTHREAD_BENCH_H
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+/*
+ * Pieces shared by the benchmark modules (the kthread examples, lock_bench,
+ * lock-stat.h and dynamic_mem), so their results read the same way.
+ *
+ * Run files: a debugfs file per benchmark. Reading shows the last results,
+ * any write runs the benchmark and blocks until it is done. Runs and shows
+ * of all files that share a lock are serialized by it.
+ *   static const struct kt_bench_file my_bench = { &my_lock, my_run, my_show };
+ *   kt_bench_create_file("bench", dir, &my_bench);
+ *
+ * Latency histograms: values below 2^bits get a bucket each, above that every
+ * power of two is split into 2^bits buckets, so a bucket is at most 1/2^bits
+ * of its values wide. bits 0 is a plain log2 histogram.
+ *   u64 hist[KT_HIST_BUCKETS(KT_HIST_BITS)];
+ *   hist[kt_hist_bucket(ns, KT_HIST_BITS)]++;
+ *   p99 = kt_hist_percentile(hist, KT_HIST_BITS, total, 990);
+ * A percentile is the sample of rank (total - 1) * permille / 1000, counted
+ * from 0 in sorted order, reported as the upper bound of its bucket.
+ */
+
+struct kt_bench_file
+{
+	struct mutex *lock;
+	int (*run)(void);
+	void (*show)(struct seq_file *s);
+};
+
+static int kt_bench_seq_show(struct seq_file *s, void *unused)
+{
+	const struct kt_bench_file *bf = s->private;
+
+	mutex_lock(bf->lock);
+	bf->show(s);
+	mutex_unlock(bf->lock);
+	return 0;
+}
+
+static int kt_bench_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, kt_bench_seq_show, inode->i_private);
+}
+
+static ssize_t kt_bench_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+{
+	struct seq_file *s = filp->private_data;
+	const struct kt_bench_file *bf = s->private;
+	int ret;
+
+	mutex_lock(bf->lock);
+	ret = bf->run();
+	mutex_unlock(bf->lock);
+	return ret ? ret : count;
+}
+
+static const struct file_operations kt_bench_fops =
+{
+	.open    = kt_bench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.write   = kt_bench_write,
+	.release = single_release,
+	.owner   = THIS_MODULE
+};
+
+/* failures are not fatal, the module works without its debugfs files */
+static inline void kt_bench_create_file(const char *name, struct dentry *parent,
+					const struct kt_bench_file *bf)
+{
+	debugfs_create_file(name, 0600, parent, (void *)bf, &kt_bench_fops);
+}
+
+/* precision of the benchmark histograms: buckets at most 12.5% wide */
+#define KT_HIST_BITS		3
+#define KT_HIST_BUCKETS(bits)	((64 - (bits) + 1) << (bits))
+
+static inline unsigned int kt_hist_bucket(u64 v, unsigned int bits)
+{
+	unsigned int msb;
+
+	if(v < (1ULL << bits))
+		return v;
+	msb = fls64(v) - 1;
+	return ((msb - bits + 1) << bits) + ((v >> (msb - bits)) & ((1U << bits) - 1));
+}
+
+/* smallest value that falls into bucket idx */
+static inline u64 kt_hist_lower(unsigned int idx, unsigned int bits)
+{
+	unsigned int msb;
+
+	if(idx < (1U << bits))
+		return idx;
+	msb = (idx >> bits) + bits - 1;
+	return (u64)((1U << bits) + (idx & ((1U << bits) - 1))) << (msb - bits);
+}
+
+/* largest value that falls into bucket idx */
+static inline u64 kt_hist_upper(unsigned int idx, unsigned int bits)
+{
+	if(idx + 1 >= KT_HIST_BUCKETS(bits))
+		return U64_MAX;
+	return kt_hist_lower(idx + 1, bits) - 1;
+}
+
+static inline u64 kt_hist_total(const u64 *hist, unsigned int bits)
+{
+	u64 total = 0;
+	unsigned int i;
+
+	for(i = 0; i < KT_HIST_BUCKETS(bits); i++)
+		total += hist[i];
+	return total;
+}
+
+/* upper bound of the bucket holding the sample of rank (total - 1) * permille / 1000 */
+static inline u64 kt_hist_percentile(const u64 *hist, unsigned int bits, u64 total, unsigned int permille)
+{
+	u64 rank, seen = 0;
+	unsigned int i;
+
+	if(!total)
+		return 0;
+	rank = div_u64((total - 1) * permille, 1000);
+	for(i = 0; i < KT_HIST_BUCKETS(bits); i++)
+	{
+		seen += hist[i];
+		if(seen > rank)
+			return kt_hist_upper(i, bits);
+	}
+	return 0;
+}
+
+#endif
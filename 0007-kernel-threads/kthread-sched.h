@@ -0,0 +1,238 @@
+#ifndef KTHREAD_SCHED_H
+#define KTHREAD_SCHED_H
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <uapi/linux/sched/types.h>
+
+/*
+ * Scheduling policy, priority and cpu affinity of an example kthread, as one
+ * string module parameter that can also be changed at run time:
+ *
+ *   <policy>[:<args>][@<cpulist>]
+ *
+ *   normal[:nice]                          SCHED_NORMAL, nice -20..19
+ *   fifo:prio / rr:prio                    SCHED_FIFO / SCHED_RR, prio 1..99
+ *   deadline:runtime_us/deadline_us[/period_us]   SCHED_DEADLINE
+ *   @cpulist                               e.g. @2 or @0-1,3, default all cpus
+ *
+ *   insmod kernel-thread.ko my_thread_sched=fifo:50@1
+ *   echo normal > /sys/module/kernel_thread/parameters/my_thread_sched
+ *
+ * SCHED_DEADLINE admission control requires the full cpu mask, so deadline
+ * cannot be combined with @cpulist.
+ *
+ * Usage:
+ *   static struct kt_sched my_thread_sched;
+ *   module_param_cb(my_thread_sched, &kt_sched_param_ops, &my_thread_sched, 0644);
+ *   ...
+ *   kt_sched_attach(&my_thread_sched, my_thread);   after the thread is created
+ *   kt_sched_detach(&my_thread_sched);             before kthread_stop()
+ */
+#define KT_SCHED_STR_LEN	64
+
+/*
+ * The cpus are kept as the cpulist string, not as a cpumask: with a large
+ * NR_CPUS a cpumask_t is 1KB, too big for the stack copies of a setting.
+ */
+struct kt_sched
+{
+	struct task_struct *task;
+	bool set;
+	char str[KT_SCHED_STR_LEN];
+	struct sched_attr attr;
+	char cpus[KT_SCHED_STR_LEN];
+};
+
+/* cpulist into mask, an empty list is all cpus */
+static inline int kt_sched_parse_cpus(const char *cpus, struct cpumask *mask)
+{
+	if(!cpus[0])
+	{
+		cpumask_copy(mask, cpu_possible_mask);
+		return 0;
+	}
+	if(cpulist_parse(cpus, mask) || cpumask_empty(mask))
+		return -EINVAL;
+	return 0;
+}
+
+/* parse str into s, s is only changed on success */
+static inline int kt_sched_parse(struct kt_sched *s, const char *str)
+{
+	char buf[KT_SCHED_STR_LEN], *policy, *args, *cpus;
+	struct sched_attr attr = { .size = sizeof(attr) };
+	u64 runtime, deadline, period = 0;
+	cpumask_var_t mask;
+	int prio, nice = 0;
+	int ret;
+
+	if(strscpy(buf, str, sizeof(buf)) < 0)
+		return -E2BIG;
+	policy = strim(buf);
+
+	/* 1. @cpulist, only checked here, apply turns it into a mask again */
+	cpus = strchr(policy, '@');
+	if(cpus)
+	{
+		*cpus++ = '\0';
+		if(!cpus[0])
+			return -EINVAL;
+		if(!alloc_cpumask_var(&mask, GFP_KERNEL))
+			return -ENOMEM;
+		ret = kt_sched_parse_cpus(cpus, mask);
+		free_cpumask_var(mask);
+		if(ret)
+			return ret;
+	}
+
+	/* 2. policy and its arguments */
+	args = strchr(policy, ':');
+	if(args)
+		*args++ = '\0';
+
+	if(!strcmp(policy, "normal"))
+	{
+		if(args && (kstrtoint(args, 0, &nice) || nice < MIN_NICE || nice > MAX_NICE))
+			return -EINVAL;
+		attr.sched_policy = SCHED_NORMAL;
+		attr.sched_nice = nice;
+	}
+	else if(!strcmp(policy, "fifo") || !strcmp(policy, "rr"))
+	{
+		if(!args || kstrtoint(args, 0, &prio) || prio < 1 || prio > MAX_RT_PRIO - 1)
+			return -EINVAL;
+		attr.sched_policy = policy[0] == 'f' ? SCHED_FIFO : SCHED_RR;
+		attr.sched_priority = prio;
+	}
+	else if(!strcmp(policy, "deadline"))
+	{
+		if(!args || sscanf(args, "%llu/%llu/%llu", &runtime, &deadline, &period) < 2)
+			return -EINVAL;
+		if(cpus)
+			return -EINVAL;
+		attr.sched_policy = SCHED_DEADLINE;
+		attr.sched_runtime = runtime * NSEC_PER_USEC;
+		attr.sched_deadline = deadline * NSEC_PER_USEC;
+		attr.sched_period = (period ? period : deadline) * NSEC_PER_USEC;
+	}
+	else
+	{
+		return -EINVAL;
+	}
+
+	strscpy(s->str, str, sizeof(s->str));
+	strim(s->str);
+	s->attr = attr;
+	strscpy(s->cpus, cpus ? cpus : "", sizeof(s->cpus));
+	s->set = true;
+	return 0;
+}
+
+/*
+ * apply the settings to the attached thread, if any. On failure the thread
+ * keeps its old affinity and policy.
+ */
+static inline int kt_sched_apply(struct kt_sched *s)
+{
+	cpumask_var_t mask, old;
+	int ret;
+
+	if(!s->task || !s->set)
+		return 0;
+	if(!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+	if(!alloc_cpumask_var(&old, GFP_KERNEL))
+	{
+		ret = -ENOMEM;
+		goto free_mask;
+	}
+
+	ret = kt_sched_parse_cpus(s->cpus, mask);
+	if(ret)
+		goto free_old;
+
+	/* affinity first: a deadline thread keeps all cpus */
+	cpumask_copy(old, &s->task->cpus_mask);
+	ret = set_cpus_allowed_ptr(s->task, mask);
+	if(ret)
+		goto free_old;
+	ret = sched_setattr_nocheck(s->task, &s->attr);
+	if(ret)
+		set_cpus_allowed_ptr(s->task, old);
+
+free_old:
+	free_cpumask_var(old);
+free_mask:
+	free_cpumask_var(mask);
+	return ret;
+}
+
+/* a rejected setting leaves the parameter and the thread as they were */
+static inline int kt_sched_param_set(const char *val, const struct kernel_param *kp)
+{
+	struct kt_sched *s = kp->arg;
+	struct kt_sched *tmp;
+	int ret;
+
+	/* parse and apply a copy, s is only updated once both succeeded */
+	tmp = kmemdup(s, sizeof(*s), GFP_KERNEL);
+	if(!tmp)
+		return -ENOMEM;
+
+	ret = kt_sched_parse(tmp, val);
+	if(ret)
+		goto free_tmp;
+	ret = kt_sched_apply(tmp);
+	if(ret)
+	{
+		pr_err("%s: %s not applied: %d\r\n", kp->name, tmp->str, ret);
+		goto free_tmp;
+	}
+	*s = *tmp;
+
+free_tmp:
+	kfree(tmp);
+	return ret;
+}
+
+static inline int kt_sched_param_get(char *buffer, const struct kernel_param *kp)
+{
+	struct kt_sched *s = kp->arg;
+
+	return sysfs_emit(buffer, "%s\n", s->set ? s->str : "default");
+}
+
+static const struct kernel_param_ops kt_sched_param_ops =
+{
+	.set = kt_sched_param_set,
+	.get = kt_sched_param_get,
+};
+
+/* parameter writes are serialized with attach/detach by the module's param lock */
+static inline int kt_sched_attach(struct kt_sched *s, struct task_struct *task)
+{
+	int ret;
+
+	kernel_param_lock(THIS_MODULE);
+	s->task = task;
+	ret = kt_sched_apply(s);
+	kernel_param_unlock(THIS_MODULE);
+	if(ret)
+		pr_err("%s: %s not applied: %d\r\n", task->comm, s->str, ret);
+	return ret;
+}
+
+static inline void kt_sched_detach(struct kt_sched *s)
+{
+	kernel_param_lock(THIS_MODULE);
+	s->task = NULL;
+	kernel_param_unlock(THIS_MODULE);
+}
+
+#endif
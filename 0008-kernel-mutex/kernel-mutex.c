@@ -4,21 +4,75 @@
 #include <linux/kthread.h>
 #include <linux/mutex.h>
 #include <linux/delay.h>
+#include <linux/percpu_counter.h>
+#include "kthread-sched.h"
+#include "lock-stat.h"
 
 
 /* object for the threads */
 struct task_struct *thread_th1;
 struct task_struct *thread_th2;
 
+/* scheduling policy, priority and cpus of the threads, see kthread-sched.h */
+static struct kt_sched thread1_sched;
+module_param_cb(thread1_sched, &kt_sched_param_ops, &thread1_sched, 0644);
+MODULE_PARM_DESC(thread1_sched, "my_thread1 scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+static struct kt_sched thread2_sched;
+module_param_cb(thread2_sched, &kt_sched_param_ops, &thread2_sched, 0644);
+MODULE_PARM_DESC(thread2_sched, "my_thread2 scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+
 /* obj for the mutext */
 struct mutex my_mutex;
+LOCK_STAT_DEFINE(my_mutex);
 int global_resource =0;
 
+/*
+ * percpu_mode: the resource is only a counter, so it does not need the mutex
+ * at all. A percpu_counter lets every cpu count into its own slot and fold
+ * into the shared total every percpu_counter_batch increments.
+ */
+bool percpu_mode;
+module_param(percpu_mode, bool, S_IRUGO);
+MODULE_PARM_DESC(percpu_mode, "count with a percpu_counter instead of the mutex (default 0)");
+
+struct percpu_counter precious_counter;
+
+/* approximate value, lock free: can lag by up to percpu_counter_batch per cpu */
+static s64 precious_resource_read(void)
+{
+	if(percpu_mode)
+		return percpu_counter_read_positive(&precious_counter);
+	return READ_ONCE(global_resource);
+}
+
+/* exact value: takes the mutex, or folds the slot of every cpu */
+static s64 precious_resource_read_exact(void)
+{
+	s64 val;
+
+	if(percpu_mode)
+		return percpu_counter_sum_positive(&precious_counter);
+
+	ls_mutex_lock(my_mutex);
+	val = global_resource;
+	ls_mutex_unlock(my_mutex);
+	return val;
+}
 
 void access_precious_resource(void)
 {
+	if(percpu_mode)
+	{
+		percpu_counter_inc(&precious_counter);
+		pr_info("operation on precious resource: ~%lld\r\n", precious_resource_read());
+		return;
+	}
+
+	ls_mutex_lock(my_mutex);
 	pr_info("operation on precious resource: %d\r\n", global_resource++);
+	ls_mutex_unlock(my_mutex);
 }
+
 static int thread1_callback_fun(void *)
 {
 	pr_info("thread1_callback is executing\r\n");
@@ -27,9 +81,7 @@ static int thread1_callback_fun(void *)
 	{
 		pr_info("accessing the precious resource \r\n");
 
-		mutex_lock(&my_mutex);
 		access_precious_resource();
-		mutex_unlock(&my_mutex);
 		ssleep(1);
 	}
 	return 0;
@@ -42,9 +94,7 @@ static int thread2_callback_fun(void *)
 	{
 		pr_info("accessing the precious resource\r\n");
 
-		mutex_lock(&my_mutex);
 		access_precious_resource();
-		mutex_unlock(&my_mutex);
 		ssleep(1);
 	}
 
@@ -53,35 +103,62 @@ static int thread2_callback_fun(void *)
 
 static int __init mutex_module_init(void)
 {
+	int ret;
+
 	pr_info("mutex ex. module init\r\n");
 
+	/*init the mutex to avoid race condition, before the threads can use it */
+	mutex_init(&my_mutex);
+	ret = lock_stat_init();
+	if(ret)
+		return ret;
+	ret = percpu_counter_init(&precious_counter, 0, GFP_KERNEL);
+	if(ret)
+		goto exit_lock_stat;
+
 	/*1. creating the first thread */
 	thread_th1 = kthread_run(thread1_callback_fun, NULL, "my_thread1");
 	if(IS_ERR(thread_th1))
 	{
 		pr_err("fail to creat first thread\r\n");
-		return PTR_ERR(thread_th1);
+		ret = PTR_ERR(thread_th1);
+		goto destroy_counter;
 	}
+	kt_sched_attach(&thread1_sched, thread_th1);
 
 	/*2. creating the second  thread */
 	thread_th2 = kthread_run(thread2_callback_fun, NULL, "my_thread2");
 	if(IS_ERR(thread_th2))
 	{
 		pr_err("fail to creat first thread\r\n");
-		return PTR_ERR(thread_th2);
+		ret = PTR_ERR(thread_th2);
+		goto stop_thread1;
 	}
-
-	/*init the mutex to avoid race condition */
-	mutex_init(&my_mutex);
+	kt_sched_attach(&thread2_sched, thread_th2);
 
 	return 0;
+
+stop_thread1:
+	kt_sched_detach(&thread1_sched);
+	kthread_stop(thread_th1);
+destroy_counter:
+	percpu_counter_destroy(&precious_counter);
+exit_lock_stat:
+	lock_stat_exit();
+	return ret;
 }
 
 static void __exit mutex_module_exit(void)
 {
 	pr_info("mutex ex module exir \r\n");
+	kt_sched_detach(&thread1_sched);
+	kt_sched_detach(&thread2_sched);
 	kthread_stop(thread_th1);
 	kthread_stop(thread_th2);
+
+	pr_info("precious resource final value: %lld\r\n", precious_resource_read_exact());
+	percpu_counter_destroy(&precious_counter);
+	lock_stat_exit();
 }
 
 module_init(mutex_module_init);
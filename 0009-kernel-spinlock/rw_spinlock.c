@@ -4,13 +4,27 @@
 #include <linux/delay.h>
 #include <linux/spinlock.h>
 #include <linux/kthread.h>
+#include "kthread-sched.h"
+#include "lock-stat.h"
 
 /* instances for the thread and task */
 static rwlock_t my_lock;
+LOCK_STAT_DEFINE(my_lock);
 static struct task_struct *write_thread;
 static struct task_struct *read_thread_1;
 static struct task_struct *read_thread_2;
 
+/* scheduling policy, priority and cpus of the threads, see kthread-sched.h */
+static struct kt_sched write_thread_sched;
+module_param_cb(write_thread_sched, &kt_sched_param_ops, &write_thread_sched, 0644);
+MODULE_PARM_DESC(write_thread_sched, "write_thread scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+static struct kt_sched read_thread_1_sched;
+module_param_cb(read_thread_1_sched, &kt_sched_param_ops, &read_thread_1_sched, 0644);
+MODULE_PARM_DESC(read_thread_1_sched, "read_thread_1 scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+static struct kt_sched read_thread_2_sched;
+module_param_cb(read_thread_2_sched, &kt_sched_param_ops, &read_thread_2_sched, 0644);
+MODULE_PARM_DESC(read_thread_2_sched, "read_thread_2 scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+
 int global_var = 0;
 int g_read_var;
 
@@ -19,10 +33,10 @@ static int write_callback_func(void *p)
 {
 	while(!kthread_should_stop())
 	{
-		write_lock(&my_lock);
+		ls_write_lock(my_lock);
 		global_var ++;
 		pr_info("WRITE THREAD : global_var: %d", global_var);
-		write_unlock(&my_lock);
+		ls_write_unlock(my_lock);
 		ssleep(1);
 	}
 	return 0;
@@ -62,7 +76,16 @@ static int read_callback_func_2(void *p)
 
 static int __init rw_spinlock_module_init(void)
 {
+	int ret;
+
 	pr_info("read-write spinlock init module");
+
+	/*init read-write spinlock, before the threads can take it*/
+	rwlock_init(&my_lock);
+	ret = lock_stat_init();
+	if(ret)
+		return ret;
+
 	write_thread = kthread_run(write_callback_func, NULL, "write_thread");
 	read_thread_1 = kthread_run(read_callback_func_1, NULL, "read_thread_1");
 	read_thread_2 = kthread_run(read_callback_func_2, NULL, "read_thread_2");
@@ -70,11 +93,19 @@ static int __init rw_spinlock_module_init(void)
 	if(IS_ERR(write_thread) || IS_ERR(read_thread_1) || IS_ERR(read_thread_2))
 	{
 		pr_err("failed to create the threads");
+		/* the threads that did start must be gone before the stats are freed */
+		if(!IS_ERR(write_thread))
+			kthread_stop(write_thread);
+		if(!IS_ERR(read_thread_1))
+			kthread_stop(read_thread_1);
+		if(!IS_ERR(read_thread_2))
+			kthread_stop(read_thread_2);
+		lock_stat_exit();
 		return -1;
 	}
-
-	/*init read-write spinlock*/
-	rwlock_init(&my_lock);
+	kt_sched_attach(&write_thread_sched, write_thread);
+	kt_sched_attach(&read_thread_1_sched, read_thread_1);
+	kt_sched_attach(&read_thread_2_sched, read_thread_2);
 
 	return 0;
 }
@@ -82,12 +113,16 @@ static int __init rw_spinlock_module_init(void)
 static void __exit rw_spinlock_module_exit(void)
 {
 	pr_info("read-write spinlock exit module");
+	kt_sched_detach(&write_thread_sched);
+	kt_sched_detach(&read_thread_1_sched);
+	kt_sched_detach(&read_thread_2_sched);
 	 if(write_thread)
 		 kthread_stop(write_thread);
 	 if(read_thread_1)
 		 kthread_stop(read_thread_1);
 	 if(read_thread_2)
 		 kthread_stop(read_thread_2);
+	lock_stat_exit();
 }
 
 module_init(rw_spinlock_module_init);
@@ -3,6 +3,9 @@
 #include <linux/init.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include <linux/percpu_counter.h>
+#include "kthread-sched.h"
+#include "lock-stat.h"
 
 int global_var =0;
 
@@ -10,12 +13,68 @@ int global_var =0;
 struct task_struct *Thread_th1; 
 struct task_struct *Thread_th2;
 
+/* scheduling policy, priority and cpus of the threads, see kthread-sched.h */
+static struct kt_sched thread1_sched;
+module_param_cb(thread1_sched, &kt_sched_param_ops, &thread1_sched, 0644);
+MODULE_PARM_DESC(thread1_sched, "my_thread1 scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+static struct kt_sched thread2_sched;
+module_param_cb(thread2_sched, &kt_sched_param_ops, &thread2_sched, 0644);
+MODULE_PARM_DESC(thread2_sched, "my_thread2 scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+
 /*spinlock obj*/
 spinlock_t my_lock;
+LOCK_STAT_DEFINE(my_lock);
+
+/*
+ * percpu_mode: global_var is only a counter, every cpu can count into its own
+ * slot of a percpu_counter instead of bouncing my_lock and global_var between
+ * the cpus. The slots are folded into the total every percpu_counter_batch
+ * increments.
+ */
+bool percpu_mode;
+module_param(percpu_mode, bool, S_IRUGO);
+MODULE_PARM_DESC(percpu_mode, "count with a percpu_counter instead of the spinlock (default 0)");
+
+struct percpu_counter global_counter;
+
+/* approximate value, lock free: can lag by up to percpu_counter_batch per cpu */
+static s64 global_var_read(void)
+{
+	if(percpu_mode)
+		return percpu_counter_read_positive(&global_counter);
+	return READ_ONCE(global_var);
+}
+
+/* exact value: takes the spinlock, or folds the slot of every cpu */
+static s64 global_var_read_exact(void)
+{
+	s64 val;
+
+	if(percpu_mode)
+		return percpu_counter_sum_positive(&global_counter);
+
+	ls_spin_lock(my_lock);
+	val = global_var;
+	ls_spin_unlock(my_lock);
+	return val;
+}
 
 static void access_precious_resource(void)
 {
-	pr_info("making operation on global_var: %d", global_var++);
+	int val;
+
+	if(percpu_mode)
+	{
+		percpu_counter_inc(&global_counter);
+		pr_info("making operation on global_var: ~%lld", global_var_read());
+		return;
+	}
+
+	/* no printk under the spinlock */
+	ls_spin_lock(my_lock);
+	val = global_var++;
+	ls_spin_unlock(my_lock);
+	pr_info("making operation on global_var: %d", val);
 }
 
 static int thread1_callback_func(void *)
@@ -24,9 +83,7 @@ static int thread1_callback_func(void *)
 
 	while(!kthread_should_stop())
 	{
-		spin_lock(&my_lock);
 		access_precious_resource();
-		spin_unlock(&my_lock);
 		msleep(1000);
 	}
 	return 0;
@@ -38,9 +95,7 @@ static int thread2_callback_func(void *)
 
 	while(!kthread_should_stop())
 	{
-		spin_lock(&my_lock);
 		access_precious_resource();
-		spin_unlock(&my_lock);
 		msleep(1000);
 	}
 	return 0;
@@ -48,31 +103,60 @@ static int thread2_callback_func(void *)
 
 static int __init module_spinlock_init(void)
 {
+	int ret;
+
 	pr_info("Module spinlock init");
+
+	/* the lock and the counter must be ready before the threads run */
+	spin_lock_init(&my_lock);
+	ret = lock_stat_init();
+	if(ret)
+		return ret;
+	ret = percpu_counter_init(&global_counter, 0, GFP_KERNEL);
+	if(ret)
+		goto exit_lock_stat;
+
 	Thread_th1 = kthread_run(thread1_callback_func, NULL, "my_thread1");
 	if(IS_ERR(Thread_th1))
 	{
 		pr_err("failed to start thread1");
-		return (PTR_ERR(Thread_th1));
+		ret = PTR_ERR(Thread_th1);
+		goto destroy_counter;
 	}
+	kt_sched_attach(&thread1_sched, Thread_th1);
 
 	Thread_th2 = kthread_run(thread2_callback_func, NULL, "my_thread2");
 	if(IS_ERR(Thread_th2))
 	{
 		pr_err("failed to start thread2");
-		return (PTR_ERR(Thread_th2));
+		ret = PTR_ERR(Thread_th2);
+		goto stop_thread1;
 	}
-
-	spin_lock_init(&my_lock);
+	kt_sched_attach(&thread2_sched, Thread_th2);
 
 	return 0;
+
+stop_thread1:
+	kt_sched_detach(&thread1_sched);
+	kthread_stop(Thread_th1);
+destroy_counter:
+	percpu_counter_destroy(&global_counter);
+exit_lock_stat:
+	lock_stat_exit();
+	return ret;
 }
 
 static void __exit module_spinlock_exit(void)
 {
 	pr_info("Module spinlock exit");
+	kt_sched_detach(&thread1_sched);
+	kt_sched_detach(&thread2_sched);
+	kthread_stop(Thread_th1);
 	kthread_stop(Thread_th2);
-	kthread_stop(Thread_th2);
+
+	pr_info("global_var final value: %lld", global_var_read_exact());
+	percpu_counter_destroy(&global_counter);
+	lock_stat_exit();
 }
 
 module_init(module_spinlock_init);
@@ -4,11 +4,22 @@
 #include <linux/seqlock.h>
 #include <linux/kthread.h>
 #include <linux/delay.h>
+#include "kthread-sched.h"
+#include "lock-stat.h"
 
 
 static struct task_struct *thread_th1;
 static struct task_struct *thread_th2;
+
+/* scheduling policy, priority and cpus of the threads, see kthread-sched.h */
+static struct kt_sched thread1_sched;
+module_param_cb(thread1_sched, &kt_sched_param_ops, &thread1_sched, 0644);
+MODULE_PARM_DESC(thread1_sched, "thread_1 scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
+static struct kt_sched thread2_sched;
+module_param_cb(thread2_sched, &kt_sched_param_ops, &thread2_sched, 0644);
+MODULE_PARM_DESC(thread2_sched, "thread_2 scheduling: normal[:nice]|fifo:prio|rr:prio|deadline:rt_us/dl_us[/period_us], [@cpulist]");
 seqlock_t my_seqlock;
+LOCK_STAT_DEFINE(my_seqlock);
 int global_var =0;
 
 static int read_callback_func(void *)
@@ -33,9 +44,9 @@ static int write_callback_func(void *)
 {
 	while(!kthread_should_stop())
 	{
-		write_seqlock(&my_seqlock);
+		ls_write_seqlock(my_seqlock);
 		global_var ++;
-		write_sequnlock(&my_seqlock);
+		ls_write_sequnlock(my_seqlock);
 		ssleep(1);
 	}
 
@@ -44,27 +55,47 @@ static int write_callback_func(void *)
 
 static int __init module_seqlock_init(void)
 {
+	int ret;
+
 	pr_info("module seqlock init fun");
+
+	/* the seqlock must be ready before the threads run */
+	seqlock_init(&my_seqlock);
+	ret = lock_stat_init();
+	if(ret)
+		return ret;
+
 	thread_th1 = kthread_run(write_callback_func, NULL, "thread_1");
 	if(IS_ERR(thread_th1))
 	{
-	return (PTR_ERR(thread_th1));
+		ret = PTR_ERR(thread_th1);
+		goto exit_lock_stat;
 	}
+	kt_sched_attach(&thread1_sched, thread_th1);
 
 	thread_th2 = kthread_run(read_callback_func, NULL, "thread_2");
 	if(IS_ERR(thread_th2))
 	{
-	return (PTR_ERR(thread_th2));
+		ret = PTR_ERR(thread_th2);
+		goto stop_thread1;
 	}
-
-	seqlock_init(&my_seqlock);
+	kt_sched_attach(&thread2_sched, thread_th2);
 
 	return 0;
+
+stop_thread1:
+	kt_sched_detach(&thread1_sched);
+	kthread_stop(thread_th1);
+exit_lock_stat:
+	lock_stat_exit();
+	return ret;
 }
 
 static void __exit module_seqlock_exit(void)
 {
 	pr_info("module seqlock exit function");
+	kt_sched_detach(&thread1_sched);
+	kt_sched_detach(&thread2_sched);
 	if(thread_th1)
 	{
 		kthread_stop(thread_th1);
@@ -74,6 +105,7 @@ static void __exit module_seqlock_exit(void)
 	{
 		kthread_stop(thread_th2);
 	}
+	lock_stat_exit();
 }
 
 module_init(module_seqlock_init);
@@ -0,0 +1,368 @@
+#ifndef LOCK_STAT_H
+#define LOCK_STAT_H
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+
+/*
+ * Hold-time and wait-time instrumentation of exclusive driver locks, without
+ * CONFIG_LOCK_STAT. Built only with -DLOCK_STAT (make LOCK_STAT=y in the
+ * example directories); otherwise every wrapper is the plain lock call and
+ * nothing below the #else is compiled in.
+ *
+ * Every call site of a lock wrapper is its own lock site. Per site and per
+ * cpu it counts acquisitions and contended acquisitions, and keeps log2
+ * histograms of the wait time (lock call to acquired) and of the hold time
+ * (acquired to unlock). Results are in /sys/kernel/debug/<module>_lock_stat/stats,
+ * writing to that file resets them.
+ *
+ * Usage, the lock is passed by name, not by address:
+ *   struct mutex my_mutex;
+ *   LOCK_STAT_DEFINE(my_mutex);
+ *   ...
+ *   lock_stat_init();                    in module init, before the lock is used
+ *   ls_mutex_lock(my_mutex);
+ *   ls_mutex_unlock(my_mutex);
+ *   lock_stat_exit();                    in module exit, after the last use
+ *
+ * Only exclusive acquisitions are covered (mutex_lock, spin_lock, write_lock,
+ * write_seqlock): the holder's acquire time is kept next to the lock, which
+ * works because there is only one holder at a time.
+ */
+#ifdef LOCK_STAT
+
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "kthread-bench.h"
+
+/* sites per module, further sites are counted in ls_dropped_sites only */
+#define LOCK_STAT_MAX_SITES	16
+/* the shared histogram with plain log2 buckets, to keep the per-cpu counters small */
+#define LOCK_STAT_HIST_BITS	0
+#define LOCK_STAT_BUCKETS	KT_HIST_BUCKETS(LOCK_STAT_HIST_BITS)
+
+struct lock_stat_site
+{
+	const char *lock;
+	const char *func;
+	int line;
+	int id;
+};
+
+/* state of the current holder, kept next to the lock */
+struct lock_stat_lock
+{
+	struct lock_stat_site *site;
+	u64 acquired_ns;
+};
+
+struct lock_stat_cpu
+{
+	u64 acquired;
+	u64 contended;
+	u64 wait_ns;
+	u64 hold_ns;
+	u32 wait_hist[LOCK_STAT_BUCKETS];
+	u32 hold_hist[LOCK_STAT_BUCKETS];
+};
+
+struct lock_stat_pcpu
+{
+	struct lock_stat_cpu site[LOCK_STAT_MAX_SITES];
+};
+
+static struct lock_stat_pcpu __percpu *ls_pcpu;
+static struct lock_stat_site *ls_sites[LOCK_STAT_MAX_SITES];
+static int ls_nr_sites;
+static int ls_dropped_sites;
+static DEFINE_RAW_SPINLOCK(ls_sites_lock);
+static struct dentry *ls_debugfs_dir;
+
+#define LOCK_STAT_DEFINE(name)	struct lock_stat_lock name##_lock_stat
+
+#define LOCK_STAT_SITE(name)	{ .lock = #name, .func = __func__, .line = __LINE__, .id = -1 }
+
+/* id of site, assigned on its first use; LOCK_STAT_MAX_SITES when the table is full */
+static inline int lock_stat_site_id(struct lock_stat_site *site)
+{
+	unsigned long flags;
+	int id = READ_ONCE(site->id), n;
+
+	if(likely(id >= 0))
+		return id;
+
+	raw_spin_lock_irqsave(&ls_sites_lock, flags);
+	if(site->id < 0)
+	{
+		n = ls_nr_sites;
+		if(n < LOCK_STAT_MAX_SITES)
+		{
+			ls_sites[n] = site;
+			/* the table entry is visible before the reader sees the new count */
+			smp_store_release(&ls_nr_sites, n + 1);
+			WRITE_ONCE(site->id, n);
+		}
+		else
+		{
+			ls_dropped_sites++;
+			WRITE_ONCE(site->id, LOCK_STAT_MAX_SITES);
+		}
+	}
+	id = site->id;
+	raw_spin_unlock_irqrestore(&ls_sites_lock, flags);
+	return id;
+}
+
+/* the lock is held now: account the wait, remember when and where it was taken */
+static inline void lock_stat_acquired(struct lock_stat_site *site, struct lock_stat_lock *lk,
+				      u64 t0, bool contended)
+{
+	u64 now = ktime_get_ns(), wait = now - t0;
+	int id = lock_stat_site_id(site);
+
+	lk->site = site;
+	lk->acquired_ns = now;
+	if(!ls_pcpu || id >= LOCK_STAT_MAX_SITES)
+		return;
+
+	/* this_cpu ops: safe against preemption and interrupts */
+	this_cpu_inc(ls_pcpu->site[id].acquired);
+	if(contended)
+		this_cpu_inc(ls_pcpu->site[id].contended);
+	this_cpu_add(ls_pcpu->site[id].wait_ns, wait);
+	this_cpu_inc(ls_pcpu->site[id].wait_hist[kt_hist_bucket(wait, LOCK_STAT_HIST_BITS)]);
+}
+
+/* called by the holder right before the unlock */
+static inline void lock_stat_release(struct lock_stat_lock *lk)
+{
+	u64 hold = ktime_get_ns() - lk->acquired_ns;
+	int id = READ_ONCE(lk->site->id);
+
+	if(!ls_pcpu || id >= LOCK_STAT_MAX_SITES)
+		return;
+	this_cpu_add(ls_pcpu->site[id].hold_ns, hold);
+	this_cpu_inc(ls_pcpu->site[id].hold_hist[kt_hist_bucket(hold, LOCK_STAT_HIST_BITS)]);
+}
+
+/* contended: the trylock failed, so the lock call below will wait */
+#define ls_mutex_lock(name)							\
+do										\
+{										\
+	static struct lock_stat_site __ls_site = LOCK_STAT_SITE(name);		\
+	u64 __ls_t0 = ktime_get_ns();						\
+	bool __ls_contended = !mutex_trylock(&(name));				\
+										\
+	if(__ls_contended)							\
+		mutex_lock(&(name));						\
+	lock_stat_acquired(&__ls_site, &name##_lock_stat, __ls_t0, __ls_contended); \
+} while(0)
+
+#define ls_mutex_unlock(name)							\
+do										\
+{										\
+	lock_stat_release(&name##_lock_stat);					\
+	mutex_unlock(&(name));							\
+} while(0)
+
+#define ls_spin_lock(name)							\
+do										\
+{										\
+	static struct lock_stat_site __ls_site = LOCK_STAT_SITE(name);		\
+	u64 __ls_t0 = ktime_get_ns();						\
+	bool __ls_contended = !spin_trylock(&(name));				\
+										\
+	if(__ls_contended)							\
+		spin_lock(&(name));						\
+	lock_stat_acquired(&__ls_site, &name##_lock_stat, __ls_t0, __ls_contended); \
+} while(0)
+
+#define ls_spin_unlock(name)							\
+do										\
+{										\
+	lock_stat_release(&name##_lock_stat);					\
+	spin_unlock(&(name));							\
+} while(0)
+
+#define ls_write_lock(name)							\
+do										\
+{										\
+	static struct lock_stat_site __ls_site = LOCK_STAT_SITE(name);		\
+	u64 __ls_t0 = ktime_get_ns();						\
+	bool __ls_contended = !write_trylock(&(name));				\
+										\
+	if(__ls_contended)							\
+		write_lock(&(name));						\
+	lock_stat_acquired(&__ls_site, &name##_lock_stat, __ls_t0, __ls_contended); \
+} while(0)
+
+#define ls_write_unlock(name)							\
+do										\
+{										\
+	lock_stat_release(&name##_lock_stat);					\
+	write_unlock(&(name));							\
+} while(0)
+
+/* seqlock_t has no write trylock: a writer that finds the lock taken counts as contended */
+#define ls_write_seqlock(name)							\
+do										\
+{										\
+	static struct lock_stat_site __ls_site = LOCK_STAT_SITE(name);		\
+	u64 __ls_t0 = ktime_get_ns();						\
+	bool __ls_contended = spin_is_locked(&(name).lock);			\
+										\
+	write_seqlock(&(name));							\
+	lock_stat_acquired(&__ls_site, &name##_lock_stat, __ls_t0, __ls_contended); \
+} while(0)
+
+#define ls_write_sequnlock(name)						\
+do										\
+{										\
+	lock_stat_release(&name##_lock_stat);					\
+	write_sequnlock(&(name));						\
+} while(0)
+
+static inline void lock_stat_show_hist(struct seq_file *s, const char *what, const u64 *hist)
+{
+	unsigned int b;
+
+	seq_printf(s, "  %s_ns:", what);
+	for(b = 0; b < LOCK_STAT_BUCKETS; b++)
+	{
+		if(hist[b])
+			seq_printf(s, " %llu-%llu:%llu", kt_hist_lower(b, LOCK_STAT_HIST_BITS),
+				   kt_hist_upper(b, LOCK_STAT_HIST_BITS), hist[b]);
+	}
+	seq_puts(s, "\n");
+}
+
+static inline int lock_stat_show(struct seq_file *s, void *unused)
+{
+	int nr = smp_load_acquire(&ls_nr_sites), id, cpu, b;
+	u64 *wait_hist, *hold_hist;
+
+	/* both folded histograms, too big for the stack */
+	wait_hist = kcalloc(2 * LOCK_STAT_BUCKETS, sizeof(u64), GFP_KERNEL);
+	if(!wait_hist)
+		return -ENOMEM;
+	hold_hist = wait_hist + LOCK_STAT_BUCKETS;
+
+	seq_printf(s, "%-16s %-28s %10s %10s %11s %11s %11s %11s\n", "lock", "site", "acquired",
+		   "contended", "wait_avg_ns", "wait_p99_ns", "hold_avg_ns", "hold_p99_ns");
+	for(id = 0; id < nr; id++)
+	{
+		struct lock_stat_site *site = ls_sites[id];
+		u64 acquired = 0, contended = 0, wait_ns = 0, hold_ns = 0, held;
+		char where[64];
+
+		/* 1. fold the cpus; log2 buckets, so the percentiles are within a factor of 2 */
+		memset(wait_hist, 0, 2 * LOCK_STAT_BUCKETS * sizeof(u64));
+		for_each_possible_cpu(cpu)
+		{
+			struct lock_stat_cpu *c = &per_cpu_ptr(ls_pcpu, cpu)->site[id];
+
+			acquired += READ_ONCE(c->acquired);
+			contended += READ_ONCE(c->contended);
+			wait_ns += READ_ONCE(c->wait_ns);
+			hold_ns += READ_ONCE(c->hold_ns);
+			for(b = 0; b < LOCK_STAT_BUCKETS; b++)
+			{
+				wait_hist[b] += READ_ONCE(c->wait_hist[b]);
+				hold_hist[b] += READ_ONCE(c->hold_hist[b]);
+			}
+		}
+		held = kt_hist_total(hold_hist, LOCK_STAT_HIST_BITS);
+
+		/* 2. one summary line and the two histograms */
+		snprintf(where, sizeof(where), "%s:%d", site->func, site->line);
+		seq_printf(s, "%-16s %-28s %10llu %10llu %11llu %11llu %11llu %11llu\n", site->lock, where,
+			   acquired, contended, acquired ? div64_u64(wait_ns, acquired) : 0,
+			   kt_hist_percentile(wait_hist, LOCK_STAT_HIST_BITS, acquired, 990),
+			   held ? div64_u64(hold_ns, held) : 0,
+			   kt_hist_percentile(hold_hist, LOCK_STAT_HIST_BITS, held, 990));
+		lock_stat_show_hist(s, "wait", wait_hist);
+		lock_stat_show_hist(s, "hold", hold_hist);
+	}
+	if(ls_dropped_sites)
+		seq_printf(s, "%d sites not tracked, raise LOCK_STAT_MAX_SITES\n", ls_dropped_sites);
+	kfree(wait_hist);
+	return 0;
+}
+
+static inline int lock_stat_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, lock_stat_show, NULL);
+}
+
+/* any write resets the counters, updates running at the same time may survive */
+static inline ssize_t lock_stat_write(struct file *filp, const char __user *buff, size_t count,
+				      loff_t *f_pos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(ls_pcpu, cpu), 0, sizeof(struct lock_stat_pcpu));
+	return count;
+}
+
+static const struct file_operations lock_stat_fops =
+{
+	.open    = lock_stat_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.write   = lock_stat_write,
+	.release = single_release,
+	.owner   = THIS_MODULE
+};
+
+static inline int lock_stat_init(void)
+{
+	ls_pcpu = alloc_percpu(struct lock_stat_pcpu);
+	if(!ls_pcpu)
+		return -ENOMEM;
+
+	/* failures here are not fatal, the counters still run */
+	ls_debugfs_dir = debugfs_create_dir(KBUILD_MODNAME "_lock_stat", NULL);
+	debugfs_create_file("stats", 0600, ls_debugfs_dir, NULL, &lock_stat_fops);
+	return 0;
+}
+
+static inline void lock_stat_exit(void)
+{
+	debugfs_remove_recursive(ls_debugfs_dir);
+	free_percpu(ls_pcpu);
+	ls_pcpu = NULL;
+}
+
+#else
+
+#define LOCK_STAT_DEFINE(name)
+
+#define ls_mutex_lock(name)		mutex_lock(&(name))
+#define ls_mutex_unlock(name)		mutex_unlock(&(name))
+#define ls_spin_lock(name)		spin_lock(&(name))
+#define ls_spin_unlock(name)		spin_unlock(&(name))
+#define ls_write_lock(name)		write_lock(&(name))
+#define ls_write_unlock(name)		write_unlock(&(name))
+#define ls_write_seqlock(name)		write_seqlock(&(name))
+#define ls_write_sequnlock(name)	write_sequnlock(&(name))
+
+static inline int lock_stat_init(void)
+{
+	return 0;
+}
+
+static inline void lock_stat_exit(void)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,869 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu_counter.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "kthread-bench.h"
+
+/*
+ * Lock contention benchmark
+ *
+ * The mutex, spinlock and seqlock examples touch one shared variable once a
+ * second. Here nr_threads kthreads, thread i bound to the i-th online cpu,
+ * hammer the same shared object for duration_ms under each primitive in
+ * turn: mutex, spinlock, rwlock, seqlock and RCU.
+ *
+ * Every op is a read (read_pct percent of them) or a write of the object and
+ * spends cs_ns inside the critical section, and think_ns outside of it.
+ *   echo 1 > /sys/kernel/debug/lock_bench/bench
+ *   cat /sys/kernel/debug/lock_bench/bench
+ *
+ * counter_scaling compares the ways to keep a shared counter, as in the
+ * mutex and spinlock examples, from one thread up to one per online cpu.
+ */
+unsigned int nr_threads;
+module_param(nr_threads, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(nr_threads, "benchmark threads, 0: one per online cpu (default 0)");
+
+unsigned int duration_ms = 1000;
+module_param(duration_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(duration_ms, "run time per primitive in ms (default 1000)");
+
+unsigned int cs_ns = 100;
+module_param(cs_ns, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(cs_ns, "time spent inside the critical section in ns (default 100)");
+
+unsigned int think_ns;
+module_param(think_ns, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(think_ns, "time spent outside the critical section in ns (default 0)");
+
+unsigned int read_pct = 90;
+module_param(read_pct, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(read_pct, "percentage of ops that are reads (default 90)");
+
+#define LB_MAX_THREADS		256U
+#define LB_MAX_DURATION_MS	60000U
+#define LB_MAX_CS_NS		100000U
+
+/*
+ * the shared object: a writer bumps seq and stores ~seq in check, with the
+ * critical section in between. A reader that sees check != ~seq read a torn
+ * object, which none of the primitives may allow.
+ */
+struct lb_obj
+{
+	u64 seq;
+	u64 check;
+	struct rcu_head rcu;
+};
+
+struct lb_shared
+{
+	struct mutex mutex;
+	spinlock_t spinlock;
+	rwlock_t rwlock;
+	seqlock_t seqlock;
+	/* RCU: readers follow the pointer, writers copy under rcu_wlock */
+	spinlock_t rcu_wlock;
+	struct lb_obj __rcu *rcu_obj;
+	struct lb_obj obj;
+} ____cacheline_aligned_in_smp;
+
+struct lb_shared lb_shared;
+
+struct lb_run;
+
+struct lb_thread
+{
+	struct task_struct *task;
+	struct lb_run *run;
+	unsigned int idx;
+	u32 rnd;
+	u64 reads;
+	u64 writes;
+	u64 retries;
+	u64 torn;
+	u64 failures;
+	u64 max_ns;
+	u64 hist[KT_HIST_BUCKETS(KT_HIST_BITS)];	/* acquisition latency */
+};
+
+struct lb_run
+{
+	const struct lb_prim *prim;
+	unsigned int cs_ns;
+	unsigned int think_ns;
+	unsigned int read_pct;
+	bool stop;
+	struct completion start;
+	struct completion done;
+	atomic_t remaining;
+	unsigned int nr;
+	struct lb_thread *threads;
+};
+
+/* busy wait, the critical section must not sleep under a spinlock */
+static void lb_spin(unsigned int ns)
+{
+	u64 end;
+
+	if(!ns)
+		return;
+	end = ktime_get_ns() + ns;
+	while(ktime_get_ns() < end)
+		cpu_relax();
+}
+
+static void lb_record(struct lb_thread *t, u64 ns)
+{
+	t->hist[kt_hist_bucket(ns, KT_HIST_BITS)]++;
+	if(ns > t->max_ns)
+		t->max_ns = ns;
+}
+
+static void lb_acquired(struct lb_thread *t, u64 t0)
+{
+	lb_record(t, ktime_get_ns() - t0);
+}
+
+static void lb_read_obj(struct lb_thread *t, struct lb_obj *obj)
+{
+	u64 seq = READ_ONCE(obj->seq);
+
+	lb_spin(t->run->cs_ns);
+	if(READ_ONCE(obj->check) != ~seq)
+		t->torn++;
+}
+
+static void lb_write_obj(struct lb_thread *t, struct lb_obj *obj)
+{
+	u64 seq = obj->seq + 1;
+
+	WRITE_ONCE(obj->seq, seq);
+	lb_spin(t->run->cs_ns);
+	WRITE_ONCE(obj->check, ~seq);
+}
+
+/* one primitive: a read and a write op, each records its acquisition latency */
+struct lb_prim
+{
+	const char *name;
+	void (*read)(struct lb_thread *t);
+	void (*write)(struct lb_thread *t);
+	int (*setup)(void);
+	void (*teardown)(void);
+	/* exact count after the run, counters only */
+	s64 (*count)(void);
+};
+
+static void lb_mutex_op(struct lb_thread *t, bool write)
+{
+	u64 t0 = ktime_get_ns();
+
+	mutex_lock(&lb_shared.mutex);
+	lb_acquired(t, t0);
+	if(write)
+		lb_write_obj(t, &lb_shared.obj);
+	else
+		lb_read_obj(t, &lb_shared.obj);
+	mutex_unlock(&lb_shared.mutex);
+}
+
+static void lb_mutex_read(struct lb_thread *t)
+{
+	lb_mutex_op(t, false);
+}
+
+static void lb_mutex_write(struct lb_thread *t)
+{
+	lb_mutex_op(t, true);
+}
+
+static void lb_spinlock_op(struct lb_thread *t, bool write)
+{
+	u64 t0 = ktime_get_ns();
+
+	spin_lock(&lb_shared.spinlock);
+	lb_acquired(t, t0);
+	if(write)
+		lb_write_obj(t, &lb_shared.obj);
+	else
+		lb_read_obj(t, &lb_shared.obj);
+	spin_unlock(&lb_shared.spinlock);
+}
+
+static void lb_spinlock_read(struct lb_thread *t)
+{
+	lb_spinlock_op(t, false);
+}
+
+static void lb_spinlock_write(struct lb_thread *t)
+{
+	lb_spinlock_op(t, true);
+}
+
+static void lb_rwlock_read(struct lb_thread *t)
+{
+	u64 t0 = ktime_get_ns();
+
+	read_lock(&lb_shared.rwlock);
+	lb_acquired(t, t0);
+	lb_read_obj(t, &lb_shared.obj);
+	read_unlock(&lb_shared.rwlock);
+}
+
+static void lb_rwlock_write(struct lb_thread *t)
+{
+	u64 t0 = ktime_get_ns();
+
+	write_lock(&lb_shared.rwlock);
+	lb_acquired(t, t0);
+	lb_write_obj(t, &lb_shared.obj);
+	write_unlock(&lb_shared.rwlock);
+}
+
+/*
+ * a seqlock reader takes no lock, it waits in read_seqbegin() while a write
+ * is in progress and retries when one happened meanwhile: its latency is the
+ * time until the attempt that went through began
+ */
+static void lb_seqlock_read(struct lb_thread *t)
+{
+	struct lb_obj *obj = &lb_shared.obj;
+	u64 t0 = ktime_get_ns(), t1;
+	unsigned int seq_no;
+	u64 seq, check;
+
+	for(;;)
+	{
+		seq_no = read_seqbegin(&lb_shared.seqlock);
+		t1 = ktime_get_ns();
+		seq = READ_ONCE(obj->seq);
+		lb_spin(t->run->cs_ns);
+		check = READ_ONCE(obj->check);
+		if(!read_seqretry(&lb_shared.seqlock, seq_no))
+			break;
+		t->retries++;
+	}
+	lb_record(t, t1 - t0);
+	if(check != ~seq)
+		t->torn++;
+}
+
+static void lb_seqlock_write(struct lb_thread *t)
+{
+	u64 t0 = ktime_get_ns();
+
+	write_seqlock(&lb_shared.seqlock);
+	lb_acquired(t, t0);
+	lb_write_obj(t, &lb_shared.obj);
+	write_sequnlock(&lb_shared.seqlock);
+}
+
+static void lb_rcu_read(struct lb_thread *t)
+{
+	u64 t0 = ktime_get_ns();
+
+	rcu_read_lock();
+	lb_acquired(t, t0);
+	lb_read_obj(t, rcu_dereference(lb_shared.rcu_obj));
+	rcu_read_unlock();
+}
+
+/* copy, update, publish; the old copy is freed after a grace period */
+static void lb_rcu_write(struct lb_thread *t)
+{
+	struct lb_obj *new, *old;
+	u64 t0;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if(!new)
+	{
+		t->failures++;
+		return;
+	}
+
+	t0 = ktime_get_ns();
+	spin_lock(&lb_shared.rcu_wlock);
+	lb_acquired(t, t0);
+	old = rcu_dereference_protected(lb_shared.rcu_obj, lockdep_is_held(&lb_shared.rcu_wlock));
+	new->seq = old->seq;
+	new->check = old->check;
+	lb_write_obj(t, new);
+	rcu_assign_pointer(lb_shared.rcu_obj, new);
+	spin_unlock(&lb_shared.rcu_wlock);
+
+	kfree_rcu(old, rcu);
+}
+
+static int lb_rcu_setup(void)
+{
+	struct lb_obj *obj = kzalloc(sizeof(*obj), GFP_KERNEL);
+
+	if(!obj)
+		return -ENOMEM;
+	obj->check = ~0ULL;
+	rcu_assign_pointer(lb_shared.rcu_obj, obj);
+	return 0;
+}
+
+static void lb_rcu_teardown(void)
+{
+	struct lb_obj *obj = rcu_dereference_protected(lb_shared.rcu_obj, 1);
+
+	RCU_INIT_POINTER(lb_shared.rcu_obj, NULL);
+	synchronize_rcu();
+	kfree(obj);
+}
+
+enum lb_prim_id
+{
+	LB_MUTEX,
+	LB_SPINLOCK,
+	LB_RWLOCK,
+	LB_SEQLOCK,
+	LB_RCU,
+	LB_NR_PRIMS
+};
+
+const struct lb_prim lb_prims[LB_NR_PRIMS] =
+{
+	[LB_MUTEX]    = { "mutex", lb_mutex_read, lb_mutex_write },
+	[LB_SPINLOCK] = { "spinlock", lb_spinlock_read, lb_spinlock_write },
+	[LB_RWLOCK]   = { "rwlock", lb_rwlock_read, lb_rwlock_write },
+	[LB_SEQLOCK]  = { "seqlock", lb_seqlock_read, lb_seqlock_write },
+	[LB_RCU]      = { "rcu", lb_rcu_read, lb_rcu_write, lb_rcu_setup, lb_rcu_teardown },
+};
+
+/*
+ * shared counters: access_precious_resource() of the mutex and spinlock
+ * examples only increments one. Every op of these is an increment, the
+ * latency is the time the increment took.
+ */
+struct lb_counter
+{
+	struct mutex mutex;
+	spinlock_t spinlock;
+	u64 value;
+	atomic64_t atomic;
+	struct percpu_counter pcpu;
+} ____cacheline_aligned_in_smp;
+
+struct lb_counter lb_counter;
+
+static void lb_cnt_mutex_inc(struct lb_thread *t)
+{
+	u64 t0 = ktime_get_ns();
+
+	mutex_lock(&lb_counter.mutex);
+	lb_counter.value++;
+	mutex_unlock(&lb_counter.mutex);
+	lb_acquired(t, t0);
+}
+
+static void lb_cnt_spinlock_inc(struct lb_thread *t)
+{
+	u64 t0 = ktime_get_ns();
+
+	spin_lock(&lb_counter.spinlock);
+	lb_counter.value++;
+	spin_unlock(&lb_counter.spinlock);
+	lb_acquired(t, t0);
+}
+
+static void lb_cnt_atomic_inc(struct lb_thread *t)
+{
+	u64 t0 = ktime_get_ns();
+
+	atomic64_inc(&lb_counter.atomic);
+	lb_acquired(t, t0);
+}
+
+/* the cpu's own slot, folded into the shared count every percpu_counter_batch */
+static void lb_cnt_percpu_inc(struct lb_thread *t)
+{
+	u64 t0 = ktime_get_ns();
+
+	percpu_counter_inc(&lb_counter.pcpu);
+	lb_acquired(t, t0);
+}
+
+static int lb_cnt_setup(void)
+{
+	lb_counter.value = 0;
+	atomic64_set(&lb_counter.atomic, 0);
+	percpu_counter_set(&lb_counter.pcpu, 0);
+	return 0;
+}
+
+static s64 lb_cnt_locked_count(void)
+{
+	return lb_counter.value;
+}
+
+static s64 lb_cnt_atomic_count(void)
+{
+	return atomic64_read(&lb_counter.atomic);
+}
+
+static s64 lb_cnt_percpu_count(void)
+{
+	return percpu_counter_sum(&lb_counter.pcpu);
+}
+
+enum lb_counter_id
+{
+	LB_CNT_MUTEX,
+	LB_CNT_SPINLOCK,
+	LB_CNT_ATOMIC,
+	LB_CNT_PERCPU,
+	LB_NR_COUNTERS
+};
+
+const struct lb_prim lb_counters[LB_NR_COUNTERS] =
+{
+	[LB_CNT_MUTEX]    = { "mutex", NULL, lb_cnt_mutex_inc, lb_cnt_setup, NULL, lb_cnt_locked_count },
+	[LB_CNT_SPINLOCK] = { "spinlock", NULL, lb_cnt_spinlock_inc, lb_cnt_setup, NULL, lb_cnt_locked_count },
+	[LB_CNT_ATOMIC]   = { "atomic64", NULL, lb_cnt_atomic_inc, lb_cnt_setup, NULL, lb_cnt_atomic_count },
+	[LB_CNT_PERCPU]   = { "percpu_counter", NULL, lb_cnt_percpu_inc, lb_cnt_setup, NULL, lb_cnt_percpu_count },
+};
+
+/* xorshift32, cheap enough to not show up in the numbers */
+static u32 lb_rand(struct lb_thread *t)
+{
+	u32 x = t->rnd;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	t->rnd = x;
+	return x;
+}
+
+static int lb_thread_fn(void *data)
+{
+	struct lb_thread *t = data;
+	struct lb_run *run = t->run;
+	const struct lb_prim *prim = run->prim;
+
+	wait_for_completion(&run->start);
+	while(!READ_ONCE(run->stop))
+	{
+		if(lb_rand(t) % 100 < run->read_pct)
+		{
+			prim->read(t);
+			t->reads++;
+		}
+		else
+		{
+			prim->write(t);
+			t->writes++;
+		}
+		lb_spin(run->think_ns);
+		cond_resched();
+	}
+	if(atomic_dec_and_test(&run->remaining))
+		complete(&run->done);
+	return 0;
+}
+
+/* results of the last run */
+struct lb_result
+{
+	unsigned int threads;
+	u64 ops_s;
+	u64 reads;
+	u64 writes;
+	u64 p50_ns;
+	u64 p99_ns;
+	u64 p999_ns;
+	u64 max_ns;
+	/* Jain's fairness index of the per-thread op counts, 1000: all equal */
+	u64 fairness;
+	u64 min_ops;
+	u64 max_ops;
+	u64 retries;
+	u64 torn;
+	u64 failures;
+	/* counters: increments that are missing from the exact count */
+	s64 lost;
+	int error;
+};
+
+struct lb_cfg
+{
+	unsigned int threads;
+	unsigned int duration_ms;
+	unsigned int cs_ns;
+	unsigned int think_ns;
+	unsigned int read_pct;
+};
+
+struct lb_bench
+{
+	bool valid;
+	struct lb_cfg cfg;
+	struct lb_result res[LB_NR_PRIMS];
+};
+
+struct lb_bench lb_bench;
+
+DEFINE_MUTEX(lb_bench_lock);
+
+/*
+ * (sum x)^2 / (n * sum x^2). The counts are scaled down first so that the
+ * squares cannot overflow with LB_MAX_THREADS threads.
+ */
+static u64 lb_fairness(struct lb_run *run, u64 max_ops)
+{
+	u64 sum = 0, sumsq = 0, x;
+	unsigned int shift = 0, i;
+
+	while((max_ops >> shift) >= (1ULL << 16))
+		shift++;
+	for(i = 0; i < run->nr; i++)
+	{
+		x = (run->threads[i].reads + run->threads[i].writes) >> shift;
+		sum += x;
+		sumsq += x * x;
+	}
+	if(!sumsq)
+		return 0;
+	return div64_u64(sum * sum * 1000, run->nr * sumsq);
+}
+
+static void lb_collect(struct lb_run *run, struct lb_result *r, u64 elapsed_ns)
+{
+	u64 *hist = run->threads[0].hist;
+	u64 total, ops;
+	unsigned int i, b;
+
+	r->min_ops = U64_MAX;
+	for(i = 0; i < run->nr; i++)
+	{
+		struct lb_thread *t = &run->threads[i];
+
+		ops = t->reads + t->writes;
+		r->reads += t->reads;
+		r->writes += t->writes;
+		r->retries += t->retries;
+		r->torn += t->torn;
+		r->failures += t->failures;
+		r->min_ops = min(r->min_ops, ops);
+		r->max_ops = max(r->max_ops, ops);
+		r->max_ns = max(r->max_ns, t->max_ns);
+		/* merge every histogram into the first one */
+		if(i)
+		{
+			for(b = 0; b < KT_HIST_BUCKETS(KT_HIST_BITS); b++)
+				hist[b] += t->hist[b];
+		}
+	}
+
+	total = kt_hist_total(hist, KT_HIST_BITS);
+	r->threads = run->nr;
+	r->ops_s = div64_u64((r->reads + r->writes) * NSEC_PER_SEC, elapsed_ns ? elapsed_ns : 1);
+	r->fairness = lb_fairness(run, r->max_ops);
+	r->p50_ns = kt_hist_percentile(hist, KT_HIST_BITS, total, 500);
+	r->p99_ns = kt_hist_percentile(hist, KT_HIST_BITS, total, 990);
+	r->p999_ns = kt_hist_percentile(hist, KT_HIST_BITS, total, 999);
+}
+
+/* run prim on cfg->threads threads, thread i bound to the i-th online cpu */
+static int lb_run_prim(const struct lb_prim *prim, const struct lb_cfg *cfg, struct lb_result *r)
+{
+	unsigned int nr = cfg->threads, i;
+	struct lb_run run = { };
+	ktime_t t0;
+	int ret = 0;
+
+	run.prim = prim;
+	run.cs_ns = cfg->cs_ns;
+	run.think_ns = cfg->think_ns;
+	run.read_pct = cfg->read_pct;
+	run.nr = nr;
+	run.threads = kvcalloc(nr, sizeof(*run.threads), GFP_KERNEL);
+	if(!run.threads)
+		return -ENOMEM;
+	init_completion(&run.start);
+	init_completion(&run.done);
+	atomic_set(&run.remaining, nr);
+
+	/* 1. fresh shared object */
+	lb_shared.obj.seq = 0;
+	lb_shared.obj.check = ~0ULL;
+	if(prim->setup)
+	{
+		ret = prim->setup();
+		if(ret)
+			goto free;
+	}
+
+	/* 2. create the threads, they wait for the start signal */
+	for(i = 0; i < nr; i++)
+	{
+		struct lb_thread *t = &run.threads[i];
+
+		t->run = &run;
+		t->idx = i;
+		t->rnd = i * 2654435761U + 1;
+		t->task = kthread_create(lb_thread_fn, t, "lock_bench/%u", i);
+		if(IS_ERR(t->task))
+		{
+			ret = PTR_ERR(t->task);
+			t->task = NULL;
+			break;
+		}
+		kthread_bind(t->task, cpumask_nth(i % num_online_cpus(), cpu_online_mask));
+		/* keep the task around for kthread_stop() even after it exits */
+		get_task_struct(t->task);
+		wake_up_process(t->task);
+	}
+
+	/* 3. threads that were not created count as finished */
+	if(ret && atomic_sub_and_test(nr - i, &run.remaining))
+		complete(&run.done);
+
+	/* 4. go, stop after duration_ms and wait for everyone to leave the loop */
+	t0 = ktime_get();
+	complete_all(&run.start);
+	msleep(cfg->duration_ms);
+	WRITE_ONCE(run.stop, true);
+	wait_for_completion(&run.done);
+
+	/* 5. reap the threads */
+	for(i = 0; i < nr; i++)
+	{
+		if(!run.threads[i].task)
+			continue;
+		kthread_stop(run.threads[i].task);
+		put_task_struct(run.threads[i].task);
+	}
+
+	if(!ret)
+	{
+		lb_collect(&run, r, ktime_to_ns(ktime_sub(ktime_get(), t0)));
+		if(prim->count)
+			r->lost = r->writes - prim->count();
+	}
+	if(prim->teardown)
+		prim->teardown();
+free:
+	kvfree(run.threads);
+	return ret;
+}
+
+static int lb_bench_run(void)
+{
+	struct lb_bench *b = &lb_bench;
+	unsigned int nr = nr_threads ? nr_threads : num_online_cpus();
+	int id;
+
+	if(nr > LB_MAX_THREADS || !duration_ms || duration_ms > LB_MAX_DURATION_MS ||
+	   cs_ns > LB_MAX_CS_NS || think_ns > LB_MAX_CS_NS || read_pct > 100)
+		return -EINVAL;
+
+	memset(b, 0, sizeof(*b));
+	b->cfg.threads = nr;
+	b->cfg.duration_ms = duration_ms;
+	b->cfg.cs_ns = cs_ns;
+	b->cfg.think_ns = think_ns;
+	b->cfg.read_pct = read_pct;
+
+	for(id = 0; id < LB_NR_PRIMS; id++)
+		b->res[id].error = lb_run_prim(&lb_prims[id], &b->cfg, &b->res[id]);
+
+	b->valid = true;
+	return 0;
+}
+
+static void lb_bench_show(struct seq_file *s)
+{
+	struct lb_bench *b = &lb_bench;
+	int id;
+
+	if(!b->valid)
+	{
+		seq_puts(s, "no results, write 1 to run the benchmark\n");
+		return;
+	}
+	seq_printf(s, "threads %u duration_ms %u cs_ns %u think_ns %u read_pct %u\n", b->cfg.threads,
+		   b->cfg.duration_ms, b->cfg.cs_ns, b->cfg.think_ns, b->cfg.read_pct);
+	seq_printf(s, "%-9s %11s %11s %11s %9s %9s %9s %10s %8s %10s %10s %10s %6s\n", "primitive",
+		   "ops_s", "reads", "writes", "p50_ns", "p99_ns", "p999_ns", "max_ns", "fairness",
+		   "min_ops", "max_ops", "retries", "torn");
+	for(id = 0; id < LB_NR_PRIMS; id++)
+	{
+		struct lb_result *r = &b->res[id];
+		u32 frac;
+		u64 whole;
+
+		if(r->error)
+		{
+			seq_printf(s, "%-9s error %d\n", lb_prims[id].name, r->error);
+			continue;
+		}
+		whole = div_u64_rem(r->fairness, 1000, &frac);
+		seq_printf(s, "%-9s %11llu %11llu %11llu %9llu %9llu %9llu %10llu %4llu.%03u %10llu %10llu %10llu %6llu\n",
+			   lb_prims[id].name, r->ops_s, r->reads, r->writes, r->p50_ns, r->p99_ns,
+			   r->p999_ns, r->max_ns, whole, frac, r->min_ops,
+			   r->max_ops, r->retries, r->torn);
+		if(r->failures)
+			seq_printf(s, "%-9s %llu writes skipped, out of memory\n", "", r->failures);
+	}
+}
+
+/*
+ * counter scaling benchmark
+ *
+ * Pure increments of a shared counter under a mutex, a spinlock, an atomic64
+ * and a percpu_counter, on 1, 2, 4, ... threads up to one per online cpu.
+ * The locked counters and the atomic bounce one cacheline between all cpus,
+ * their ops_s stays flat or drops as threads are added. The percpu_counter
+ * only touches the shared count once per percpu_counter_batch increments and
+ * should scale with the number of cpus.
+ */
+#define LB_SCALE_MAX_STEPS	16
+
+struct lb_scale_bench
+{
+	bool valid;
+	unsigned int duration_ms;
+	unsigned int steps;
+	unsigned int threads[LB_SCALE_MAX_STEPS];
+	struct lb_result res[LB_SCALE_MAX_STEPS][LB_NR_COUNTERS];
+};
+
+struct lb_scale_bench lb_scale_bench;
+
+static int lb_scale_bench_run(void)
+{
+	struct lb_scale_bench *b = &lb_scale_bench;
+	unsigned int cpus = min(num_online_cpus(), LB_MAX_THREADS), nr, step;
+	struct lb_cfg cfg = { };
+	int id;
+
+	if(!duration_ms || duration_ms > LB_MAX_DURATION_MS)
+		return -EINVAL;
+
+	memset(b, 0, sizeof(*b));
+	b->duration_ms = duration_ms;
+	cfg.duration_ms = duration_ms;
+
+	/* 1, 2, 4, ... and the number of online cpus */
+	for(nr = 1; b->steps < LB_SCALE_MAX_STEPS; nr *= 2)
+	{
+		b->threads[b->steps++] = min(nr, cpus);
+		if(nr >= cpus)
+			break;
+	}
+
+	for(step = 0; step < b->steps; step++)
+	{
+		cfg.threads = b->threads[step];
+		for(id = 0; id < LB_NR_COUNTERS; id++)
+		{
+			struct lb_result *r = &b->res[step][id];
+
+			r->error = lb_run_prim(&lb_counters[id], &cfg, r);
+		}
+	}
+
+	b->valid = true;
+	return 0;
+}
+
+static void lb_scale_bench_show(struct seq_file *s)
+{
+	struct lb_scale_bench *b = &lb_scale_bench;
+	unsigned int step;
+	int id;
+
+	if(!b->valid)
+	{
+		seq_puts(s, "no results, write 1 to run the benchmark\n");
+		return;
+	}
+	seq_printf(s, "duration_ms %u percpu_counter_batch %d\n", b->duration_ms, percpu_counter_batch);
+	seq_printf(s, "%7s %-14s %12s %9s %9s %10s %8s %8s\n", "threads", "counter", "ops_s",
+		   "p50_ns", "p99_ns", "max_ns", "fairness", "lost");
+	for(step = 0; step < b->steps; step++)
+	{
+		for(id = 0; id < LB_NR_COUNTERS; id++)
+		{
+			struct lb_result *r = &b->res[step][id];
+			u32 frac;
+			u64 whole;
+
+			if(r->error)
+			{
+				seq_printf(s, "%7u %-14s error %d\n", b->threads[step], lb_counters[id].name,
+					   r->error);
+				continue;
+			}
+			whole = div_u64_rem(r->fairness, 1000, &frac);
+			seq_printf(s, "%7u %-14s %12llu %9llu %9llu %10llu %4llu.%03u %8lld\n",
+				   b->threads[step], lb_counters[id].name, r->ops_s, r->p50_ns, r->p99_ns,
+				   r->max_ns, whole, frac, r->lost);
+		}
+	}
+}
+
+/* both files share lb_bench_lock, so only one benchmark runs at a time */
+static const struct kt_bench_file lb_lock_bench_file = { &lb_bench_lock, lb_bench_run, lb_bench_show };
+static const struct kt_bench_file lb_scale_bench_file = { &lb_bench_lock, lb_scale_bench_run, lb_scale_bench_show };
+
+struct dentry *lb_debugfs_dir;
+
+static int __init lock_bench_init(void)
+{
+	int ret;
+
+	pr_info("lock benchmark module has been loaded\r\n");
+
+	/* 1. the locks, before anything can use them */
+	mutex_init(&lb_shared.mutex);
+	spin_lock_init(&lb_shared.spinlock);
+	rwlock_init(&lb_shared.rwlock);
+	seqlock_init(&lb_shared.seqlock);
+	spin_lock_init(&lb_shared.rcu_wlock);
+	mutex_init(&lb_counter.mutex);
+	spin_lock_init(&lb_counter.spinlock);
+	ret = percpu_counter_init(&lb_counter.pcpu, 0, GFP_KERNEL);
+	if(ret)
+		return ret;
+
+	/* 2. benchmark control files */
+	lb_debugfs_dir = debugfs_create_dir("lock_bench", NULL);
+	kt_bench_create_file("bench", lb_debugfs_dir, &lb_lock_bench_file);
+	kt_bench_create_file("counter_scaling", lb_debugfs_dir, &lb_scale_bench_file);
+	return 0;
+}
+
+static void __exit lock_bench_exit(void)
+{
+	pr_info("lock benchmark module exited\r\n");
+	debugfs_remove_recursive(lb_debugfs_dir);
+	percpu_counter_destroy(&lb_counter.pcpu);
+}
+
+module_init(lock_bench_init);
+module_exit(lock_bench_exit);
+
+MODULE_DESCRIPTION("Lock primitive contention benchmark");
+MODULE_AUTHOR("MahendraSondagar<mahendrasondagar08@gmail.com>");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");